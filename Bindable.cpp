@@ -1,6 +1,7 @@
 #include "Bindable.h"
 #include "CommandBuffer.h"
 #include "Allocator.h"
+#include "Descriptor.h"
 #include "Util.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -48,7 +49,7 @@ VkSampler Sampler::Create(VkSamplerAddressMode mode, uint mip)
 
 Buffer* Buffer::Create(VkBufferUsageFlags usage, uint size, DeviceMemoryTypeIndex mem)
 {
-	Buffer* buffer = new Buffer{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER };
+	Buffer* buffer = new Buffer{ usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER };
 	buffers.push_back(buffer);
 	VkBufferCreateInfo info = { VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO };
 	info.usage = usage;
@@ -85,6 +86,8 @@ Buffer* Buffer::Create(VkBufferUsageFlags usage, uint size, void* src)
 
 void Buffer::Free()
 {
+	DescriptorSetLayout::Invalidate(this);
+	freed++;
 	DestroyBuffer(handle());
 	ptr ? VkFreeShared(memory) : VkFreeLocal(memory);
 	buffers.erase(std::find(buffers.begin(), buffers.end(), this));
@@ -132,6 +135,8 @@ Image* Image::Create(VkFormat format, VkImageUsageFlags usage, VkExtent2D extent
 
 void Image::Free()
 {
+	DescriptorSetLayout::Invalidate(this);
+	freed++;
 	DestroyImageView(info.image.imageView);
 	VkFreeLocal(memory);
 	DestroyImage(handle);
@@ -8,6 +8,8 @@ struct Sampler
 
 struct Bindable
 {
+	// bumped by every Free, caches keyed on bindable addresses compare it to drop entries a reused address could alias
+	inline static uint freed = 0;
 	VkDescriptorType type;
 	union DescriptorInfo
 	{
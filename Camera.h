@@ -9,6 +9,8 @@ struct Camera
     vec4 pos;
     vec4 ray;
     vec2 normalizer;
+    float znear = 0.1f;
+    float zfar = 4000;
     double sens = 4;
     double speed = 0.2;
     Window* io;
@@ -22,7 +24,7 @@ struct Camera
 
     void set_prj(float fov, float x, float y)
     {
-        prj = perspective(fov, x, y, 0.1, 4000);
+        prj = perspective(fov, x, y, znear, zfar);
         normalizer = { 1.f / prj.x.x, 1.f / prj.y.y }; 
     };
 
@@ -48,13 +50,19 @@ struct Camera
         if (io->GetInputRepeat('D')) pos = fmadd (ss, view.x, pos);
     }
 
+    //world to view space, +z forward
+    mat world_to_view()
+    {
+        mat view2 = view.tpos();
+        view2.w = (pos ^ sign_mask<1, 1, 1, 0>()) * view2;
+        return view2;
+    }
+
     mat update()
     {
         update_rotation();
         update_position();
-        mat view2 = view.tpos();
-        view2.w = (pos ^ sign_mask<1, 1, 1, 0>()) * view2;
-        return view2 * prj;
+        return world_to_view() * prj;
     }
 
 };
@@ -100,6 +100,11 @@ void CommandBuffer::DrawIndexedIndirect(VkBuffer buffer, VkDeviceSize offset, ui
 	vkCmdDrawIndexedIndirect(handle, buffer, offset, drawCount, stride);
 }
 
+void CommandBuffer::DrawIndexedIndirectCount(VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint maxDrawCount, uint stride)
+{
+	vkCmdDrawIndexedIndirectCount(handle, buffer, offset, countBuffer, countBufferOffset, maxDrawCount, stride);
+}
+
 void CommandBuffer::Dispatch(uint groupCountX, uint groupCountY, uint groupCountZ)
 {
 	vkCmdDispatch(handle, groupCountX, groupCountY, groupCountZ);
@@ -358,3 +363,119 @@ void CommandBuffer::PushDescriptorSet(VkPipelineBindPoint pipelineBindPoint, VkP
 {
 	VkEXTFN::PushDescriptorSet(handle, pipelineBindPoint, layout, set, descriptorWriteCount, pDescriptorWrites);
 }
+
+void StateCache::Invalidate()
+{
+	memset(pipeline, 0, sizeof(pipeline));
+	memset(sets, 0, sizeof(sets));
+	memset(vertex, 0, sizeof(vertex));
+	index = 0;
+	viewport = {};
+	scissor = {};
+	npush = 0;
+}
+
+void StateCache::BindPipeline(VkPipelineBindPoint bindPoint, VkPipeline handle)
+{
+	if (enabled && pipeline[bindPoint] == handle)
+	{
+		elided++;
+		return;
+	}
+	issued++;
+	pipeline[bindPoint] = handle;
+	cmd.BindPipeline(bindPoint, handle);
+}
+
+void StateCache::BindDescriptorSet(VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint slot, VkDescriptorSet set)
+{
+	if (enabled && slot < MAX_TRACKED_SETS && sets[bindPoint][slot] == set)
+	{
+		elided++;
+		return;
+	}
+	issued++;
+	if (slot < MAX_TRACKED_SETS)
+		sets[bindPoint][slot] = set;
+	cmd.BindDescriptorSets(bindPoint, layout, slot, 1, &set, 0, 0);
+}
+
+void StateCache::SetPushed(VkPipelineBindPoint bindPoint, uint slot)
+{
+	issued++;
+	if (slot < MAX_TRACKED_SETS)
+		sets[bindPoint][slot] = 0;
+}
+
+void StateCache::BindVertexBuffers(uint first, uint count, const VkBuffer* buffers, const VkDeviceSize* offsets)
+{
+	bool same = enabled && first + count <= MAX_TRACKED_STREAMS;
+	for (uint i = 0; same && i < count; ++i)
+		same = vertex[first + i] == buffers[i] && voffset[first + i] == offsets[i];
+	if (same)
+	{
+		elided++;
+		return;
+	}
+	issued++;
+	for (uint i = 0; i < count && first + i < MAX_TRACKED_STREAMS; ++i)
+	{
+		vertex[first + i] = buffers[i];
+		voffset[first + i] = offsets[i];
+	}
+	cmd.BindVertexBuffers(first, count, buffers, offsets);
+}
+
+void StateCache::BindIndexBuffer(VkBuffer buffer, VkDeviceSize offset)
+{
+	if (enabled && index == buffer && ioffset == offset)
+	{
+		elided++;
+		return;
+	}
+	issued++;
+	index = buffer;
+	ioffset = offset;
+	cmd.BindIndexBuffer(buffer, offset, VK_INDEX_TYPE_UINT32);
+}
+
+void StateCache::SetViewport(VkViewport const& vp)
+{
+	if (enabled && !memcmp(&viewport, &vp, sizeof(VkViewport)))
+	{
+		elided++;
+		return;
+	}
+	issued++;
+	viewport = vp;
+	cmd.SetViewport(0, 1, &vp);
+}
+
+void StateCache::SetScissor(VkRect2D const& rect)
+{
+	if (enabled && !memcmp(&scissor, &rect, sizeof(VkRect2D)))
+	{
+		elided++;
+		return;
+	}
+	issued++;
+	scissor = rect;
+	cmd.SetScissor(0, 1, &rect);
+}
+
+//only the contiguous range [0, npush) is known, anything pushed outside it is always recorded
+void StateCache::PushConstants(VkPipelineLayout layout, VkShaderStageFlags stages, uint offset, uint size, const void* data)
+{
+	if (enabled && offset + size <= npush && !memcmp(push + offset, data, size))
+	{
+		elided++;
+		return;
+	}
+	issued++;
+	if (offset <= npush && offset + size <= MAX_TRACKED_PUSH_CONSTANTS)
+	{
+		memcpy(push + offset, data, size);
+		npush = std::max(npush, offset + size);
+	}
+	cmd.PushConstants(layout, stages, offset, size, data);
+}
@@ -24,6 +24,7 @@ struct CommandBuffer : AliasType<VkCommandBuffer>
 	void DrawIndexed(uint indexCount, uint instanceCount, uint firstIndex, int32_t vertexOffset, uint firstInstance);
 	void DrawIndirect(VkBuffer buffer, VkDeviceSize offset, uint drawCount, uint stride);
 	void DrawIndexedIndirect(VkBuffer buffer, VkDeviceSize offset, uint drawCount, uint stride);
+	void DrawIndexedIndirectCount(VkBuffer buffer, VkDeviceSize offset, VkBuffer countBuffer, VkDeviceSize countBufferOffset, uint maxDrawCount, uint stride);
 	void Dispatch(uint groupCountX, uint groupCountY, uint groupCountZ);
 	void DispatchIndirect(VkBuffer buffer, VkDeviceSize offset);
 	void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, uint regionCount, const VkBufferCopy* pRegions);
@@ -57,6 +58,41 @@ struct CommandBuffer : AliasType<VkCommandBuffer>
 	void PushDescriptorSet(VkPipelineBindPoint pipelineBindPoint, VkPipelineLayout layout, uint32_t set, uint32_t descriptorWriteCount, const VkWriteDescriptorSet* pDescriptorWrites);
 };
 
+#define MAX_TRACKED_SETS 8
+#define MAX_TRACKED_STREAMS 4
+#define MAX_TRACKED_PUSH_CONSTANTS 256
+
+//remembers what is bound on one command buffer and drops binds that would not change it,
+//Invalidate must be called whenever the state becomes unknown (begin, ExecuteCommands, foreign recording)
+struct StateCache
+{
+	CommandBuffer	cmd;
+	bool			enabled = true;
+	// calls recorded and dropped since EndFrame last read them, Invalidate keeps them since it also runs mid-frame
+	uint			issued = 0;
+	uint			elided = 0;
+	VkPipeline		pipeline[2];
+	VkDescriptorSet	sets[2][MAX_TRACKED_SETS];
+	VkBuffer		vertex[MAX_TRACKED_STREAMS];
+	VkDeviceSize	voffset[MAX_TRACKED_STREAMS];
+	VkBuffer		index;
+	VkDeviceSize	ioffset;
+	VkViewport		viewport;
+	VkRect2D		scissor;
+	uint			npush;
+	uint8_t			push[MAX_TRACKED_PUSH_CONSTANTS];
+
+	void Invalidate();
+	void BindPipeline(VkPipelineBindPoint bindPoint, VkPipeline handle);
+	void BindDescriptorSet(VkPipelineBindPoint bindPoint, VkPipelineLayout layout, uint slot, VkDescriptorSet set);
+	// push descriptors are recorded straight into cmd by the set layout, this only forgets the slot
+	void SetPushed(VkPipelineBindPoint bindPoint, uint slot);
+	void BindVertexBuffers(uint first, uint count, const VkBuffer* buffers, const VkDeviceSize* offsets);
+	void BindIndexBuffer(VkBuffer buffer, VkDeviceSize offset);
+	void SetViewport(VkViewport const& vp);
+	void SetScissor(VkRect2D const& rect);
+	void PushConstants(VkPipelineLayout layout, VkShaderStageFlags stages, uint offset, uint size, const void* data);
+};
 
 inline CommandBuffer MkCmdBuffer()
 {
@@ -0,0 +1,78 @@
+#include "Culling.h"
+
+static vec4 vabs(vec4 v)
+{
+	return _mm_andnot_ps(_mm_set1_ps(-0.f), v.xmm);
+}
+
+Frustum::Frustum(mat const& vp)
+{
+	mat t = vp.tpos();
+	planes[0] = t.w + t.x;
+	planes[1] = t.w - t.x;
+	planes[2] = t.w + t.y;
+	planes[3] = t.w - t.y;
+	planes[4] = t.z;
+	planes[5] = t.w - t.z;
+	for (uint i = 0; i < 6; ++i)
+		abs[i] = vabs(planes[i]);
+}
+
+void BoxList::Clear()
+{
+	count = 0;
+}
+
+void BoxList::Push(vec4 lo, vec4 hi, mat const& xf)
+{
+	vec4 center = (lo + hi) * vec4(0.5f, 0.5f, 0.5f, 0) + vec4(0, 0, 0, 1);
+	vec4 extent = (hi - lo) * 0.5f;
+	vec4 c = center * xf;
+	vec4 e = vabs(xf.x) * extent.xxxx + vabs(xf.y) * extent.yyyy + vabs(xf.z) * extent.zzzz;
+
+	if (count == cx.size())
+	{
+		uint size = count + 8;
+		for (auto v : { &cx, &cy, &cz, &ex, &ey, &ez })
+			v->resize(size);
+	}
+	cx[count] = c.x;
+	cy[count] = c.y;
+	cz[count] = c.z;
+	ex[count] = e.x;
+	ey[count] = e.y;
+	ez[count] = e.z;
+	count++;
+}
+
+//a box is outside when it is entirely behind one plane, its distance plus the projected extent goes negative
+uint CullBoxes(Frustum const& frustum, BoxList const& boxes, uint8_t* visible)
+{
+	uint nvisible = 0;
+	for (uint i = 0; i < boxes.count; i += 8)
+	{
+		vec8 cx = _mm256_loadu_ps(&boxes.cx[i]);
+		vec8 cy = _mm256_loadu_ps(&boxes.cy[i]);
+		vec8 cz = _mm256_loadu_ps(&boxes.cz[i]);
+		vec8 ex = _mm256_loadu_ps(&boxes.ex[i]);
+		vec8 ey = _mm256_loadu_ps(&boxes.ey[i]);
+		vec8 ez = _mm256_loadu_ps(&boxes.ez[i]);
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (uint p = 0; p < 6; ++p)
+		{
+			vec4 plane = frustum.planes[p];
+			vec4 abs = frustum.abs[p];
+			vec8 d = fmadd(cx, plane.x, fmadd(cy, plane.y, fmadd(cz, plane.z, plane.w)));
+			vec8 r = fmadd(ex, abs.x, fmadd(ey, abs.y, ez * abs.z));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps((d + r).ymm, _mm256_setzero_ps(), _CMP_GE_OQ));
+		}
+		uint mask = _mm256_movemask_ps(inside);
+		uint n = std::min(8u, boxes.count - i);
+		for (uint j = 0; j < n; ++j)
+		{
+			visible[i + j] = mask >> j & 1;
+			nvisible += mask >> j & 1;
+		}
+	}
+	return nvisible;
+}
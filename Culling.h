@@ -0,0 +1,32 @@
+#pragma once
+#include "pch.h"
+#include "vmath.h"
+#include "vector"
+
+using std::vector;
+
+//planes face inwards, a point p is inside when p.x * x + p.y * y + p.z * z + w >= 0
+struct Frustum
+{
+	vec4 planes[6];
+	vec4 abs[6];
+
+	Frustum() = default;
+	//row vectors, clip = p * vp with depth in [0, 1] as produced by perspective()
+	Frustum(mat const& vp);
+};
+
+//world space boxes as centers and half extents, structure of arrays padded to a multiple of 8 for the AVX test
+struct BoxList
+{
+	vector<float>	cx, cy, cz;
+	vector<float>	ex, ey, ez;
+	uint			count;
+
+	void Clear();
+	//local box [lo, hi] transformed by xf, the result is the world space box enclosing it
+	void Push(vec4 lo, vec4 hi, mat const& xf);
+};
+
+//writes one byte per box, returns the number of visible boxes
+uint CullBoxes(Frustum const& frustum, BoxList const& boxes, uint8_t* visible);
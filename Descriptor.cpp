@@ -1,78 +1,140 @@
 #include "Descriptor.h"
 #include "Device.h"
 #include "Bindable.h"
+#include "CommandBuffer.h"
 
-DescriptorPool::DescriptorPool(vector<LayoutBinding>& bindings)
+#define MIN_POOL_SETS 64
+#define MAX_POOL_SETS 4096
+#define MAX_TEMPLATE_BINDINGS 16
+
+static void FillWrites(VkWriteDescriptorSet* writes, VkDescriptorSet set, BindableSet const& bset)
+{
+	uint i = 0;
+	for (auto bind : bset)
+	{
+		writes[i] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+		writes[i].descriptorCount = 1;
+		writes[i].descriptorType = bind->type;
+		writes[i].dstBinding = i;
+		writes[i].dstSet = set;
+		writes[i].pImageInfo = &bind->GetDescriptorInfo().image;
+		writes[i].pBufferInfo = &bind->GetDescriptorInfo().buffer;
+		i++;
+	}
+}
+
+DescriptorPool::DescriptorPool(vector<LayoutBinding>& bindings, uint capacity) :
+	capacity(capacity),
+	remaining_sets(capacity)
 {
 	vector<VkDescriptorPoolSize> poolsize;
 	for (auto binding : bindings)
 	{
-		for (auto& pool : poolsize)
-		{
-			if (pool.type == binding.type) {
-				pool.descriptorCount += 1024;
-				continue;
-			}
-		}
-		poolsize.push_back({ binding.type, 1024 });
+		auto pool = std::find_if(poolsize.begin(), poolsize.end(), [&](auto& size) { return size.type == binding.type; });
+		if (pool != poolsize.end())
+			pool->descriptorCount += capacity;
+		else
+			poolsize.push_back({ binding.type, capacity });
 	}
 
 	VkDescriptorPoolCreateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
-	info.maxSets = remaining_sets = 1024;
+	info.maxSets = capacity;
 	info.poolSizeCount = poolsize.size();
 	info.pPoolSizes = poolsize.data();
 	handle = CreateDescriptorPool(&info);
 }
 
-VkDescriptorSet DescriptorPool::TryAlloc(VkDescriptorSetLayout layout, BindableSet const& set)
+VkDescriptorSet DescriptorPool::Alloc(DescriptorSetLayout& layout, BindableSet const& set)
 {
-	if (remaining_sets <= 0)
-		return 0;
-	auto it = sets.find(set);
-	if (it != sets.end())
-		return it->second;
 	remaining_sets--;
 	return sets[set] = AllocAndBind(layout, set);
 }
 
-VkDescriptorSet DescriptorPool::AllocAndBind(VkDescriptorSetLayout layout, BindableSet const& bset)
+VkDescriptorSet DescriptorPool::AllocAndBind(DescriptorSetLayout& layout, BindableSet const& bset)
 {
 	VkDescriptorSet set;
 	VkDescriptorSetAllocateInfo info = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
 	info.descriptorPool = handle;
-	info.pSetLayouts = &layout;
+	info.pSetLayouts = &layout.handle;
 	info.descriptorSetCount = 1;
 	AllocateDescriptorSets(&info, &set);
-	vector<VkWriteDescriptorSet> writes(bset.size());
-	uint i = 0;
 
-	auto WriteSet = [](VkDescriptorSet set, VkDescriptorType type, uint binding)
+	//full sets go through the layout's update template in a single call
+	if (bset.size() == layout.bindings.size() && bset.size() <= MAX_TEMPLATE_BINDINGS)
 	{
-		VkWriteDescriptorSet write = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-		write.descriptorCount = 1;
-		write.descriptorType = type;
-		write.dstBinding = binding;
-		write.dstSet = set;
-		return write;
-	};
-
-	for (auto bind : bset)
-	{
-		writes[i] = WriteSet(set, bind->type, i);
-		writes[i].pImageInfo = &bind->GetDescriptorInfo().image;
-		writes[i].pBufferInfo = &bind->GetDescriptorInfo().buffer;
-		i++;
+		Bindable::DescriptorInfo infos[MAX_TEMPLATE_BINDINGS];
+		for (uint i = 0; i < bset.size(); ++i)
+			infos[i] = bset[i]->GetDescriptorInfo();
+		UpdateDescriptorSetWithTemplate(set, layout.update, infos);
+		return set;
 	}
+
+	vector<VkWriteDescriptorSet> writes(bset.size());
+	FillWrites(writes.data(), set, bset);
 	UpdateDescriptorSets(writes.size(), writes.data(), 0, 0);
 	return set;
 }
 
+void DescriptorPool::Invalidate(Bindable* bindable)
+{
+	for (auto it = sets.begin(); it != sets.end();)
+	{
+		if (std::find(it->first.begin(), it->first.end(), bindable) != it->first.end())
+			it = sets.erase(it);
+		else
+			++it;
+	}
+}
+
+void DescriptorPool::Reset()
+{
+	ResetDescriptorPool(handle, 0);
+	remaining_sets = capacity;
+}
+
 VkDescriptorSet DescriptorSetLayout::FindSet(BindableSet&& set)
 {
+	std::lock_guard<std::mutex> guard(lock);
+	for (auto& pool : pools)
+	{
+		auto it = pool.sets.find(set);
+		if (it != pool.sets.end())
+			return it->second;
+	}
 	for (auto& pool : pools)
-		if (auto re = pool.TryAlloc(handle, set))
-			return re;
-	return pools.emplace_front(bindings).TryAlloc(handle, set);
+		if (pool.remaining_sets)
+			return pool.Alloc(*this, set);
+	return Grow().Alloc(*this, set);
+}
+
+void DescriptorSetLayout::Push(CommandBuffer& cmd, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, BindableSet&& set)
+{
+	//same limit as the template path, larger sets build their writes on the heap
+	VkWriteDescriptorSet local[MAX_TEMPLATE_BINDINGS];
+	vector<VkWriteDescriptorSet> heap;
+	VkWriteDescriptorSet* writes = local;
+	if (set.size() > MAX_TEMPLATE_BINDINGS)
+	{
+		heap.resize(set.size());
+		writes = heap.data();
+	}
+	FillWrites(writes, 0, set);
+	cmd.PushDescriptorSet(bindPoint, layout, idx, set.size(), writes);
+}
+
+DescriptorPool& DescriptorSetLayout::Grow()
+{
+	for (auto it = pools.begin(); it != pools.end(); ++it)
+	{
+		if (it->Stale())
+		{
+			it->Reset();
+			pools.splice(pools.begin(), pools, it);
+			return pools.front();
+		}
+	}
+	uint capacity = pools.empty() ? MIN_POOL_SETS : std::min(pools.front().capacity * 2, (uint)MAX_POOL_SETS);
+	return pools.emplace_front(bindings, capacity);
 }
 
 void DescriptorSetLayout::Init()
@@ -99,7 +161,57 @@ void DescriptorSetLayout::Init()
 	info.bindingCount = bindings.size();
 	info.pNext = &extFlags;
 	info.pBindings = bind.data();
-	info.flags = 0;
+	info.flags = push ? VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR : 0;
 	handle = CreateDescriptorSetLayout(&info);
-	pools.emplace_front(bindings);
+	layouts.push_back(this);
+
+	//push descriptor sets are written straight into the command buffer, no pools or templates needed
+	if (push)
+		return;
+
+	//one entry per reflected binding, reading from a packed Bindable::DescriptorInfo array
+	vector<VkDescriptorUpdateTemplateEntry> entries;
+	for (i = 0; i < size; ++i)
+	{
+		if (!bindings[i].stage)
+			continue;
+		VkDescriptorUpdateTemplateEntry entry = {};
+		entry.dstBinding = i;
+		entry.descriptorCount = 1;
+		entry.descriptorType = bindings[i].type;
+		entry.offset = i * sizeof(Bindable::DescriptorInfo);
+		entry.stride = sizeof(Bindable::DescriptorInfo);
+		entries.push_back(entry);
+	}
+
+	VkDescriptorUpdateTemplateCreateInfo templateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_UPDATE_TEMPLATE_CREATE_INFO };
+	templateInfo.descriptorUpdateEntryCount = entries.size();
+	templateInfo.pDescriptorUpdateEntries = entries.data();
+	templateInfo.templateType = VK_DESCRIPTOR_UPDATE_TEMPLATE_TYPE_DESCRIPTOR_SET;
+	templateInfo.descriptorSetLayout = handle;
+	update = CreateDescriptorUpdateTemplate(&templateInfo);
+	Grow();
+}
+
+//sets allocated from the pools must no longer be in use by the gpu
+void DescriptorSetLayout::Destroy()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	for (auto& pool : pools)
+		DestroyDescriptorPool(pool.handle);
+	pools.clear();
+	if (update)
+		DestroyDescriptorUpdateTemplate(update);
+	update = 0;
+	DestroyDescriptorSetLayout(handle);
+	handle = 0;
+	layouts.erase(std::remove(layouts.begin(), layouts.end(), this), layouts.end());
+}
+
+void DescriptorSetLayout::Invalidate(Bindable* bindable)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	for (auto layout : layouts)
+		for (auto& pool : layout->pools)
+			pool.Invalidate(bindable);
 }
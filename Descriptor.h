@@ -3,6 +3,7 @@
 #include "vector"
 #include "unordered_map"
 #include "list"
+#include "mutex"
 
 using std::vector;
 using std::unordered_map;
@@ -30,25 +31,45 @@ namespace std
 }
 
 struct LayoutBinding { VkDescriptorType type; VkShaderStageFlags stage; };
+struct DescriptorSetLayout;
+struct CommandBuffer;
 
 struct DescriptorPool
 {
 	VkDescriptorPool handle;
+	uint			 capacity;
 	uint			 remaining_sets;
 	unordered_map<BindableSet, VkDescriptorSet>	sets;
-	DescriptorPool(vector<LayoutBinding>& bindings);
+	DescriptorPool(vector<LayoutBinding>& bindings, uint capacity);
 
-	VkDescriptorSet TryAlloc(VkDescriptorSetLayout layout, BindableSet const& set);
+	VkDescriptorSet Alloc(DescriptorSetLayout& layout, BindableSet const& set);
 
-	VkDescriptorSet AllocAndBind(VkDescriptorSetLayout layout, BindableSet const& bset);
+	VkDescriptorSet AllocAndBind(DescriptorSetLayout& layout, BindableSet const& bset);
+
+	void Invalidate(Bindable* bindable);
+
+	// every set handed out from this pool references a freed bindable
+	bool Stale() { return sets.empty() && remaining_sets < capacity; }
+
+	void Reset();
 };
 
 struct DescriptorSetLayout
 {
 	uint idx;
+	bool push;
 	vector<LayoutBinding>	bindings;
 	VkDescriptorSetLayout	handle;
+	VkDescriptorUpdateTemplate update = 0;
 	list<DescriptorPool>	pools;
 	VkDescriptorSet FindSet(BindableSet&& set);
+	void Push(CommandBuffer& cmd, VkPipelineBindPoint bindPoint, VkPipelineLayout layout, BindableSet&& set);
+	DescriptorPool& Grow();
 	void Init();
-};
\ No newline at end of file
+	void Destroy();
+
+	inline static vector<DescriptorSetLayout*> layouts;
+	// FindSet is called from the recording threads, one lock for all layouts keeps the layouts movable
+	inline static std::mutex lock;
+	static void Invalidate(Bindable* bindable);
+};
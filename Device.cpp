@@ -433,6 +433,23 @@ void UpdateDescriptorSets(uint32_t descriptorWriteCount, const VkWriteDescriptor
 	vkUpdateDescriptorSets(dev, descriptorWriteCount, pDescriptorWrites, descriptorCopyCount, pDescriptorCopies);
 }
 
+VkDescriptorUpdateTemplate CreateDescriptorUpdateTemplate(const VkDescriptorUpdateTemplateCreateInfo* pCreateInfo)
+{
+	VkDescriptorUpdateTemplate updateTemplate;
+	vkCreateDescriptorUpdateTemplate(dev, pCreateInfo, 0, &updateTemplate);
+	return updateTemplate;
+}
+
+void DestroyDescriptorUpdateTemplate(VkDescriptorUpdateTemplate descriptorUpdateTemplate)
+{
+	vkDestroyDescriptorUpdateTemplate(dev, descriptorUpdateTemplate, 0);
+}
+
+void UpdateDescriptorSetWithTemplate(VkDescriptorSet descriptorSet, VkDescriptorUpdateTemplate descriptorUpdateTemplate, const void* pData)
+{
+	vkUpdateDescriptorSetWithTemplate(dev, descriptorSet, descriptorUpdateTemplate, pData);
+}
+
 VkFramebuffer CreateFramebuffer(const VkFramebufferCreateInfo* pCreateInfo)
 {
 	VkFramebuffer fbuffer;
@@ -731,10 +748,16 @@ void InitVulkan()
 	features.sampleRateShading = 1;
 	features.vertexPipelineStoresAndAtomics = 1;
 	features.samplerAnisotropy = 1;
+	features.pipelineStatisticsQuery = GetPhysicalDeviceFeatures().pipelineStatisticsQuery;
+	features.occlusionQueryPrecise = GetPhysicalDeviceFeatures().occlusionQueryPrecise;
+	features.inheritedQueries = GetPhysicalDeviceFeatures().inheritedQueries;
+	features.multiDrawIndirect = 1;
+	features.drawIndirectFirstInstance = 1;
 
-	VkPhysicalDeviceDescriptorIndexingFeatures extFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES };
+	VkPhysicalDeviceVulkan12Features extFeatures = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
 	extFeatures.descriptorBindingPartiallyBound = 1;
 	extFeatures.descriptorBindingVariableDescriptorCount = 1;
+	extFeatures.drawIndirectCount = 1;
 
 	VkDeviceCreateInfo deviceInfo = { VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO };
 	deviceInfo.queueCreateInfoCount = 1;
@@ -67,6 +67,9 @@ void ResetDescriptorPool(VkDescriptorPool descriptorPool, VkDescriptorPoolResetF
 void AllocateDescriptorSets(const VkDescriptorSetAllocateInfo* pAllocateInfo, VkDescriptorSet* pDescriptorSets);
 void FreeDescriptorSets(VkDescriptorPool descriptorPool, uint32_t descriptorSetCount, const VkDescriptorSet* pDescriptorSets);
 void UpdateDescriptorSets(uint32_t descriptorWriteCount, const VkWriteDescriptorSet* pDescriptorWrites, uint32_t descriptorCopyCount, const VkCopyDescriptorSet* pDescriptorCopies);
+VkDescriptorUpdateTemplate CreateDescriptorUpdateTemplate(const VkDescriptorUpdateTemplateCreateInfo* pCreateInfo);
+void DestroyDescriptorUpdateTemplate(VkDescriptorUpdateTemplate descriptorUpdateTemplate);
+void UpdateDescriptorSetWithTemplate(VkDescriptorSet descriptorSet, VkDescriptorUpdateTemplate descriptorUpdateTemplate, const void* pData);
 VkFramebuffer CreateFramebuffer(const VkFramebufferCreateInfo* pCreateInfo);
 void DestroyFramebuffer(VkFramebuffer framebuffer);
 VkRenderPass CreateRenderPass(const VkRenderPassCreateInfo* pCreateInfo);
@@ -0,0 +1,64 @@
+#include "HiZ.h"
+#include "CommandBuffer.h"
+#include "Allocator.h"
+#include "Descriptor.h"
+#include "Util.h"
+
+static VkImageView MkLevelView(VkImage image, uint level, uint count)
+{
+	VkImageViewCreateInfo info = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+	info.image = image;
+	info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	info.format = VK_FORMAT_R32_SFLOAT;
+	info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	info.subresourceRange.baseMipLevel = level;
+	info.subresourceRange.levelCount = count;
+	info.subresourceRange.layerCount = 1;
+	return CreateImageView(&info);
+}
+
+void DepthPyramid::Create(VkExtent2D size)
+{
+	extent = size;
+	nlevels = 1;
+	while (nlevels < MAX_HIZ_LEVELS && (extent.width >> nlevels || extent.height >> nlevels))
+		nlevels++;
+
+	image = MkVkImage(VK_FORMAT_R32_SFLOAT, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, extent, nlevels, 1);
+	memory = VkAllocLocal((uint)GetImageMemoryRequirements(image).size);
+	BindMem(image, memory);
+
+	VkSampler sampler = Sampler::Create(VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, nlevels);
+	for (uint i = 0; i < nlevels; ++i)
+	{
+		levels[i] = { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE };
+		levels[i].info.image = { sampler, MkLevelView(image, i, 1), VK_IMAGE_LAYOUT_GENERAL };
+	}
+	all = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER };
+	all.info.image = { sampler, MkLevelView(image, 0, nlevels), VK_IMAGE_LAYOUT_GENERAL };
+
+	//the pyramid never leaves GENERAL, transitioned once here
+	VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	barrier.srcQueueFamilyIndex = barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image;
+	barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, nlevels, 0, 1 };
+	CommandBuffer cmd = MkCmdBuffer();
+	cmd.PipelineBarrier(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, 0, 0, 0, 1, &barrier);
+	SubmitCmd(cmd);
+}
+
+void DepthPyramid::Free()
+{
+	for (uint i = 0; i < nlevels; ++i)
+	{
+		DescriptorSetLayout::Invalidate(&levels[i]);
+		DestroyImageView(levels[i].info.image.imageView);
+	}
+	DescriptorSetLayout::Invalidate(&all);
+	DestroyImageView(all.info.image.imageView);
+	DestroyImage(image);
+	VkFreeLocal(memory);
+}
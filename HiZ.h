@@ -0,0 +1,33 @@
+#pragma once
+#include "pch.h"
+#include "Bindable.h"
+
+#define HIZ_GROUP_SIZE 8
+#define MAX_HIZ_LEVELS 16
+
+//push constants of hiz.comp
+struct HiZConstants
+{
+	uint level;
+	uint samples;
+};
+
+//farthest depth mip chain of the depth buffer, kept in VK_IMAGE_LAYOUT_GENERAL,
+//one storage view per level for the downsample and a sampled view over all levels for the occlusion test
+struct DepthPyramid
+{
+	VkImage		image;
+	uint64		memory;
+	VkExtent2D	extent;
+	uint		nlevels;
+	Bindable	levels[MAX_HIZ_LEVELS];
+	Bindable	all;
+
+	void Create(VkExtent2D extent);
+	void Free();
+
+	VkExtent2D LevelExtent(uint level) const
+	{
+		return { std::max(extent.width >> level, 1u), std::max(extent.height >> level, 1u) };
+	}
+};
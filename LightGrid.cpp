@@ -0,0 +1,121 @@
+#include "LightGrid.h"
+#include "cmath"
+
+static uint8_t Slice(float depth, float scale, float bias)
+{
+	return (uint8_t)std::clamp(int(logf(depth) * scale + bias), 0, CLUSTER_Z - 1);
+}
+
+static uint8_t Tile(float ndc, uint count)
+{
+	return (uint8_t)std::clamp(int((ndc * 0.5f + 0.5f) * count), 0, int(count) - 1);
+}
+
+//the view space box of each sphere projected at its nearest and farthest depth bounds its screen footprint,
+//8 lights at a time, then every covered froxel gets the light appended to its list
+void LightGrid::Build(mat const& view, float sx, float sy, float znear, float zfar, PointLight const* lights, uint count, ClusterData* out)
+{
+	scale = CLUSTER_Z / logf(zfar / znear);
+	bias = -logf(znear) * scale;
+
+	uint padded = (count + 7) & ~7u;
+	for (auto v : { &x, &y, &z, &r })
+		v->assign(padded, 0);
+	ranges.resize(count);
+	for (uint i = 0; i < count; ++i)
+	{
+		x[i] = lights[i].pos.x;
+		y[i] = lights[i].pos.y;
+		z[i] = lights[i].pos.z;
+		r[i] = lights[i].pos.w;
+	}
+
+	for (uint i = 0; i < padded; i += 8)
+	{
+		vec8 wx = _mm256_loadu_ps(&x[i]);
+		vec8 wy = _mm256_loadu_ps(&y[i]);
+		vec8 wz = _mm256_loadu_ps(&z[i]);
+		vec8 rr = _mm256_loadu_ps(&r[i]);
+		vec8 vx = fmadd(wx, view.x.x, fmadd(wy, view.y.x, fmadd(wz, view.z.x, view.w.x)));
+		vec8 vy = fmadd(wx, view.x.y, fmadd(wy, view.y.y, fmadd(wz, view.z.y, view.w.y)));
+		vec8 vz = fmadd(wx, view.x.z, fmadd(wy, view.y.z, fmadd(wz, view.z.z, view.w.z)));
+
+		vec8 zlo = _mm256_max_ps((vz - rr).ymm, _mm256_set1_ps(znear));
+		vec8 zhi = _mm256_max_ps((vz + rr).ymm, _mm256_set1_ps(znear));
+		vec8 nlo = vec8(1.f) / zlo;
+		vec8 nhi = vec8(1.f) / zhi;
+		vec8 xlo = (vx - rr) * sx, xhi = (vx + rr) * sx;
+		vec8 ylo = (vy - rr) * sy, yhi = (vy + rr) * sy;
+		vec8 x0 = _mm256_min_ps((xlo * nlo).ymm, (xlo * nhi).ymm);
+		vec8 x1 = _mm256_max_ps((xhi * nlo).ymm, (xhi * nhi).ymm);
+		vec8 y0 = _mm256_min_ps((ylo * nlo).ymm, (ylo * nhi).ymm);
+		vec8 y1 = _mm256_max_ps((yhi * nlo).ymm, (yhi * nhi).ymm);
+
+		__m256 inside = _mm256_cmp_ps((vz + rr).ymm, _mm256_set1_ps(znear), _CMP_GT_OQ);
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps((vz - rr).ymm, _mm256_set1_ps(zfar), _CMP_LT_OQ));
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps(x1.ymm, _mm256_set1_ps(-1.f), _CMP_GE_OQ));
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps(x0.ymm, _mm256_set1_ps(1.f), _CMP_LE_OQ));
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps(y1.ymm, _mm256_set1_ps(-1.f), _CMP_GE_OQ));
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps(y0.ymm, _mm256_set1_ps(1.f), _CMP_LE_OQ));
+		uint mask = _mm256_movemask_ps(inside);
+
+		float fx0[8], fx1[8], fy0[8], fy1[8], fz0[8], fz1[8];
+		_mm256_storeu_ps(fx0, x0.ymm);
+		_mm256_storeu_ps(fx1, x1.ymm);
+		_mm256_storeu_ps(fy0, y0.ymm);
+		_mm256_storeu_ps(fy1, y1.ymm);
+		_mm256_storeu_ps(fz0, zlo.ymm);
+		_mm256_storeu_ps(fz1, _mm256_min_ps((vz + rr).ymm, _mm256_set1_ps(zfar)));
+		uint n = std::min(8u, count - i);
+		for (uint j = 0; j < n; ++j)
+		{
+			auto& range = ranges[i + j];
+			range.visible = mask >> j & 1;
+			if (!range.visible)
+				continue;
+			range.x0 = Tile(fx0[j], CLUSTER_X);
+			range.x1 = Tile(fx1[j], CLUSTER_X);
+			range.y0 = Tile(fy0[j], CLUSTER_Y);
+			range.y1 = Tile(fy1[j], CLUSTER_Y);
+			range.z0 = Slice(fz0[j], scale, bias);
+			range.z1 = Slice(fz1[j], scale, bias);
+		}
+	}
+
+	auto each = [this](uint light, auto&& fn)
+	{
+		auto& range = ranges[light];
+		for (uint cz = range.z0; cz <= range.z1; ++cz)
+			for (uint cy = range.y0; cy <= range.y1; ++cy)
+				for (uint cx = range.x0; cx <= range.x1; ++cx)
+					fn((cz * CLUSTER_Y + cy) * CLUSTER_X + cx);
+	};
+
+	counts.assign(CLUSTER_COUNT, 0);
+	for (uint i = 0; i < count; ++i)
+		if (ranges[i].visible)
+			each(i, [this](uint cell) { counts[cell]++; });
+
+	//cells past the index budget are truncated rather than dropped, the overflow is reported
+	uint offset = 0, total = 0;
+	ends.resize(CLUSTER_COUNT);
+	for (uint c = 0; c < CLUSTER_COUNT; ++c)
+	{
+		uint n = std::min(counts[c], CLUSTER_MAX_INDICES - offset);
+		total += counts[c];
+		out->cells[c][0] = offset;
+		out->cells[c][1] = n;
+		counts[c] = offset;
+		offset += n;
+		ends[c] = offset;
+	}
+	nindices = offset;
+	noverflow = total - offset;
+
+	//lights are appended in order so every cell lists them ascending, written to the mapped buffer in one copy
+	indices.resize(nindices);
+	for (uint i = 0; i < count; ++i)
+		if (ranges[i].visible)
+			each(i, [this, i](uint cell) { if (counts[cell] < ends[cell]) indices[counts[cell]++] = i; });
+	memcpy(out->indices, indices.data(), nindices * sizeof(uint));
+}
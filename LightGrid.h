@@ -0,0 +1,54 @@
+#pragma once
+#include "pch.h"
+#include "vmath.h"
+#include "vector"
+
+using std::vector;
+
+//froxel grid, screen tiles times exponential depth slices, same values as shader1.frag
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+#define CLUSTER_MAX_INDICES (CLUSTER_COUNT * 32)
+#define MAX_LIGHTS 4096
+//radiance below which a light no longer contributes, sets its range from the inverse square falloff
+#define LIGHT_CUTOFF (1.f / 256)
+
+//std430 layout of Light in shader1.frag, pos.w is the range
+struct PointLight
+{
+	vec4 pos;
+	vec4 color;
+};
+
+//std430 layout of Clusters in shader1.frag, every cell is a range of indices into the light list
+struct ClusterData
+{
+	uint cells[CLUSTER_COUNT][2];
+	uint indices[CLUSTER_MAX_INDICES];
+};
+
+//assigns point lights to the froxels their bounding sphere touches, rebuilt on the cpu every frame
+struct LightGrid
+{
+	struct Range
+	{
+		uint8_t x0, x1, y0, y1, z0, z1;
+		bool	visible;
+	};
+
+	// view space spheres, structure of arrays padded to a multiple of 8 for the AVX pass
+	vector<float>	x, y, z, r;
+	vector<Range>	ranges;
+	vector<uint>	counts;
+	vector<uint>	ends;
+	vector<uint>	indices;
+	float			scale;
+	float			bias;
+	uint			nindices;
+	uint			noverflow;
+
+	//view is world to view space with +z forward, sx and sy the projection scales prj.x.x and prj.y.y
+	void Build(mat const& view, float sx, float sy, float znear, float zfar, PointLight const* lights, uint count, ClusterData* out);
+};
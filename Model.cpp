@@ -1,11 +1,68 @@
 #include "Model.h"
 #include "Renderer.h"
+#include "Simplify.h"
+#include "mango/core/thread.hpp"
 #include "assimp/Importer.hpp"
+#include "cfloat"
 #include "assimp/scene.h"
 #include "assimp/postprocess.h"
 
 unordered_map<string, Mesh*> models;
 
+//submeshes below this are cheap enough to always draw in full
+#define LOD_MIN_TRIANGLES 256
+//error budget of LOD 1 as a share of the submesh diameter, about a pixel at 1080p when the level gets selected,
+//doubles every level like the switch size halves
+#define LOD_ERROR (1.f / 256)
+
+static uint PackUnorm1010102(vec3 v)
+{
+	auto pack = [](float f) { return uint((std::clamp(f, -1.f, 1.f) * 0.5f + 0.5f) * 1023.f + 0.5f); };
+	return pack(v.x) | pack(v.y) << 10 | pack(v.z) << 20;
+}
+
+static PackedVertex PackVertex(Vertex const& v)
+{
+	PackedVertex packed;
+	packed.normal = PackUnorm1010102(v.normal);
+	packed.tangent = PackUnorm1010102(v.tangent);
+	packed.bitangent = PackUnorm1010102(v.bitangent);
+	packed.tex[0] = _cvtss_sh(v.tex.x, 0);
+	packed.tex[1] = _cvtss_sh(v.tex.y, 0);
+	return packed;
+}
+
+//each level is simplified from the previous one down to half its triangles,
+//a level that cannot drop a fifth of them within its error budget ends the chain
+static uint GenerateLods(Submesh_cache const& m, vector<vec3u>* levels)
+{
+	if (m.idx.size() < LOD_MIN_TRIANGLES)
+		return 1;
+	vector<vec3> positions(m.vert.size());
+	vec3 lo = { FLT_MAX, FLT_MAX, FLT_MAX }, hi = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+	for (uint j = 0; j < m.vert.size(); ++j)
+	{
+		vec3 p = positions[j] = m.vert[j].pos;
+		lo = { std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z) };
+		hi = { std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z) };
+	}
+	double diameter = (hi - lo).len();
+
+	Simplifier simplifier;
+	auto prev = &m.idx;
+	uint nlod = 1;
+	for (; nlod < MAX_LODS; ++nlod)
+	{
+		auto& level = levels[nlod - 1];
+		double error = diameter * LOD_ERROR * (1u << (nlod - 1));
+		simplifier.Run(prev->data(), prev->size(), positions.data(), positions.size(), prev->size() / 2, error * error, level);
+		if (level.size() * 5 > prev->size() * 4)
+			break;
+		prev = &level;
+	}
+	return nlod;
+}
+
 bool LoadMesh(const char* path, vector<Submesh_cache>& meshes, vector<Material>& materials, int extra_flags = 0)
 {
 	Assimp::Importer imp;
@@ -100,16 +157,54 @@ Mesh* Mesh::Create(const char* path, int extra_flags)
 		nvertex += mesh->submesh[idx].nvertex;
 		++idx;
 	}
-	mesh->ioffset = nvertex * sizeof(Vertex);
+
+	//simplified levels of every submesh, one task each
+	vector<vector<vec3u>> levels(meshes.size() * (MAX_LODS - 1));
+	{
+		mango::ConcurrentQueue queue;
+		for (uint i = 0; i < meshes.size(); ++i)
+			queue.enqueue([&, i] { mesh->submesh[i].nlod = GenerateLods(meshes[i], &levels[i * (MAX_LODS - 1)]); });
+		queue.wait();
+	}
+	for (uint i = 0; i < meshes.size(); ++i)
+	{
+		auto& sm = mesh->submesh[i];
+		sm.lods[0] = { sm.nidx, sm.ioffset };
+		for (uint k = 1; k < sm.nlod; ++k)
+		{
+			sm.lods[k] = { uint(levels[i * (MAX_LODS - 1) + k - 1].size() * 3), nidx };
+			nidx += sm.lods[k].nidx;
+		}
+	}
+	//[positions][packed attributes][indices][lod indices]
+	mesh->aoffset = nvertex * sizeof(vec3);
+	mesh->ioffset = mesh->aoffset + nvertex * sizeof(PackedVertex);
 	uint64 size = mesh->ioffset + nidx * 4;
 	char* blob = (char*)malloc(size);
+	vec3* positions = (vec3*)blob;
+	PackedVertex* attributes = (PackedVertex*)(blob + mesh->aoffset);
 
 	idx = 0;
+	mesh->lo = vec4(FLT_MAX);
+	mesh->hi = vec4(-FLT_MAX);
 	for (auto& m : meshes)
 	{
 		auto& sm = mesh->submesh[idx];
-		memcpy(blob + sm.voffset * sizeof(Vertex), m.vert.data(), m.vert.size() * sizeof(Vertex));
+		sm.lo = vec4(FLT_MAX);
+		sm.hi = vec4(-FLT_MAX);
+		for (uint j = 0; j < m.vert.size(); ++j)
+		{
+			vec4 pos = vec4(m.vert[j].pos.x, m.vert[j].pos.y, m.vert[j].pos.z, 0);
+			sm.lo = _mm_min_ps(sm.lo.xmm, pos.xmm);
+			sm.hi = _mm_max_ps(sm.hi.xmm, pos.xmm);
+			positions[sm.voffset + j] = m.vert[j].pos;
+			attributes[sm.voffset + j] = PackVertex(m.vert[j]);
+		}
+		mesh->lo = _mm_min_ps(mesh->lo.xmm, sm.lo.xmm);
+		mesh->hi = _mm_max_ps(mesh->hi.xmm, sm.hi.xmm);
 		memcpy(blob + mesh->ioffset + sm.ioffset * 4, m.idx.data(), m.idx.size() * sizeof(vec3u));
+		for (uint k = 1; k < sm.nlod; ++k)
+			memcpy(blob + mesh->ioffset + sm.lods[k].ioffset * 4, levels[idx * (MAX_LODS - 1) + k - 1].data(), sm.lods[k].nidx * 4);
 		++idx;
 	}
 	mesh->buffer = Buffer::Create(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, size, blob);
@@ -128,6 +223,10 @@ void AddAnimation(Mesh* mesh, const char* path)
 
 	DeviceWaitIdle();
 	mesh->buffer->Free();
+	//the skinned index set replaces every level
+	for (auto& sm : mesh->submesh)
+		sm.nlod = 1, sm.lod = 0;
+	mesh->aoffset = 0;
 	mesh->ioffset = skin.size() * sizeof(AnimationData);
 	uint total = mesh->ioffset + idx.size() * sizeof(vec3u);
 	char* blob = (char*)malloc(total);
@@ -25,6 +25,30 @@ struct Transform
     }
 };
 
+//full index set plus up to 3 simplified ones, each keeping about half the triangles of the previous
+#define MAX_LODS 4
+//level k takes over once the bounding sphere's projected diameter drops below LOD_SWITCH / 2^(k-1) of the screen height
+#define LOD_SWITCH 0.25f
+//relative band around every switch point the current level has to leave first, same value as cull.comp
+#define LOD_HYSTERESIS 0.15f
+
+//size is the projected diameter over the screen height divided by LOD_SWITCH, so switch point k sits at 2^(1-k)
+inline uint SelectLod(float size, uint current, uint nlod)
+{
+    uint lod = std::min(current, nlod - 1);
+    while (lod + 1 < nlod && size < (1 - LOD_HYSTERESIS) / float(1u << lod))
+        lod++;
+    while (lod > 0 && size > (1 + LOD_HYSTERESIS) * 2 / float(1u << lod))
+        lod--;
+    return lod;
+}
+
+struct SubmeshLod
+{
+    uint        nidx;
+    uint        ioffset;
+};
+
 struct Submesh
 {
     uint		nidx;
@@ -33,6 +57,11 @@ struct Submesh
     uint		voffset;
     Material    mat;
     string      name;
+    vec4        lo, hi;         // object space bounds
+    bool        visible = true; // frustum test result of the owning instance, refreshed every frame
+    SubmeshLod  lods[MAX_LODS]; // lods[0] is nidx and ioffset, coarser levels share the vertices and follow every full index set
+    uint        nlod = 1;
+    uint        lod = 0;        // level the owning instance drew last frame, where the hysteresis starts from
 };
 
 struct Vertex
@@ -44,6 +73,15 @@ struct Vertex
     vec2    tex;
 };
 
+//attribute stream of a static mesh, positions live in a separate stream so depth-only passes fetch 12 bytes per vertex
+struct PackedVertex
+{
+    uint        normal;     // A2B10G10R10_UNORM
+    uint        tangent;    // A2B10G10R10_UNORM
+    uint        bitangent;  // A2B10G10R10_UNORM
+    uint16_t    tex[2];     // R16G16_SFLOAT
+};
+
 struct AnimationData
 {
     vec3    pos;
@@ -155,8 +193,10 @@ struct Submesh_cache
 struct Mesh
 {
     string	            name;
+    uint		        aoffset;
     uint		        ioffset;
     vector<Submesh>	    submesh;
+    vec4                lo, hi;
     Buffer*			    buffer;
     Buffer*             anim;
 
@@ -172,10 +212,12 @@ struct Mesh
 struct MeshInstance
 {
     Transform   xform;
+    mat         prev;
     Mesh*       mesh;
 
     vector<Submesh>    submesh;
     MeshInstance(Mesh* origin) :
+        prev(xform.Get()),
         mesh(origin), 
         submesh(origin->submesh)
     {
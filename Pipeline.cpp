@@ -1,302 +1,831 @@
 #include "Pipeline.h"
 #include "Util.h"
 #include "direct.h"
-#include "shaderc/shaderc.hpp"
-#include "spirv_cross/spirv_glsl.hpp"
+#include "filesystem"
+#include "mango/core/thread.hpp"
+#include "mango/filesystem/fileobserver.hpp"
 
-
-using namespace SPIRV_CROSS_NAMESPACE;
-
-static VkPipelineShaderStageCreateInfo* mk_pss_create_info(PipelineCreateInfo& createInfo)
+//every create-info a graphics pipeline points at, filled in place from a PipelineState so nothing is heap allocated
+struct PipelineDesc
 {
-	auto info = new VkPipelineShaderStageCreateInfo[2]{};
-	info[0].sType = info[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	info[0].pName = info[1].pName = "main";
-	info[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
-	info[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-
-	VkShaderModuleCreateInfo vs = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
-	VkShaderModuleCreateInfo ps = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
-	vs.pCode = createInfo.vs.data();
-	ps.pCode = createInfo.ps.data();
-	vs.codeSize = createInfo.vs.size() * 4;
-	ps.codeSize = createInfo.ps.size() * 4;
-
-
-	info[0].module = CreateShaderModule(&vs);
-	info[1].module = CreateShaderModule(&ps);
-	return info;
+	VkPipelineShaderStageCreateInfo			stages[2];
+	VkSpecializationMapEntry				entries[MAX_SPEC_CONSTANTS];
+	VkSpecializationInfo					spec;
+	VkVertexInputBindingDescription			bindings[MAX_VERTEX_STREAMS];
+	VkVertexInputAttributeDescription		attribs[MAX_VERTEX_INPUTS];
+	VkPipelineVertexInputStateCreateInfo	input;
+	VkPipelineInputAssemblyStateCreateInfo	assembly;
+	VkPipelineViewportStateCreateInfo		viewport;
+	VkPipelineDynamicStateCreateInfo		dynamic;
+	VkPipelineRasterizationStateCreateInfo	raster;
+	VkPipelineMultisampleStateCreateInfo	multisample;
+	VkPipelineDepthStencilStateCreateInfo	depth;
+	VkPipelineColorBlendAttachmentState		attachment;
+	VkPipelineColorBlendStateCreateInfo		blend;
+	VkGraphicsPipelineCreateInfo			info;
+};
+
+static void mk_pss_create_info(PipelineDesc& desc, PipelineState const& state, ShaderModule const& vs, ShaderModule const& ps)
+{
+	for (uint i = 0; i < state.nspec; ++i)
+		desc.entries[i] = { i, i * sizeof(uint), sizeof(uint) };
+	desc.spec = { state.nspec, desc.entries, state.nspec * sizeof(uint), state.spec };
+
+	desc.stages[0] = desc.stages[1] = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+	desc.stages[0].pName = desc.stages[1].pName = "main";
+	desc.stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+	desc.stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	desc.stages[0].module = vs.handle;
+	desc.stages[1].module = ps.handle;
+	desc.stages[0].pSpecializationInfo = desc.stages[1].pSpecializationInfo = state.nspec ? &desc.spec : 0;
 }
 
-static VkPipelineVertexInputStateCreateInfo* mk_vertex_input_layout_desc(Compiler& comp, ShaderResources& res)
+//0 for a format that is not listed, the caller falls back to the reflected one
+static uint FormatSize(VkFormat format)
 {
-	auto type_stride = [](SPIRType::BaseType type)
+	switch (format)
 	{
-		switch (type)
-		{
-		case SPIRType::Int: case SPIRType::UInt: case SPIRType::Float: return 4;
-		case SPIRType::Int64: case SPIRType::UInt64: case SPIRType::Double:return 8;
-		default:return 0;
-		}
-	};
+	case VK_FORMAT_R8_UNORM: case VK_FORMAT_R8_SNORM: case VK_FORMAT_R8_UINT: case VK_FORMAT_R8_SINT: return 1;
+	case VK_FORMAT_R8G8_UNORM: case VK_FORMAT_R8G8_SNORM: case VK_FORMAT_R8G8_UINT: case VK_FORMAT_R8G8_SINT:
+	case VK_FORMAT_R16_SFLOAT: case VK_FORMAT_R16_UNORM: case VK_FORMAT_R16_SNORM: case VK_FORMAT_R16_UINT: case VK_FORMAT_R16_SINT: return 2;
+	case VK_FORMAT_R8G8B8A8_UNORM: case VK_FORMAT_R8G8B8A8_SNORM: case VK_FORMAT_R8G8B8A8_UINT: case VK_FORMAT_R8G8B8A8_SINT:
+	case VK_FORMAT_B8G8R8A8_UNORM:
+	case VK_FORMAT_A2B10G10R10_UNORM_PACK32: case VK_FORMAT_A2B10G10R10_SNORM_PACK32: case VK_FORMAT_A2B10G10R10_UINT_PACK32:
+	case VK_FORMAT_B10G11R11_UFLOAT_PACK32:
+	case VK_FORMAT_R16G16_SFLOAT: case VK_FORMAT_R16G16_UNORM: case VK_FORMAT_R16G16_SNORM: case VK_FORMAT_R16G16_UINT: case VK_FORMAT_R16G16_SINT:
+	case VK_FORMAT_R32_SFLOAT: case VK_FORMAT_R32_SINT: case VK_FORMAT_R32_UINT: return 4;
+	case VK_FORMAT_R16G16B16A16_SFLOAT: case VK_FORMAT_R16G16B16A16_UNORM: case VK_FORMAT_R16G16B16A16_SNORM:
+	case VK_FORMAT_R16G16B16A16_UINT: case VK_FORMAT_R16G16B16A16_SINT:
+	case VK_FORMAT_R32G32_SFLOAT: case VK_FORMAT_R32G32_SINT: case VK_FORMAT_R32G32_UINT: return 8;
+	case VK_FORMAT_R32G32B32_SFLOAT: case VK_FORMAT_R32G32B32_SINT: case VK_FORMAT_R32G32B32_UINT: return 12;
+	case VK_FORMAT_R32G32B32A32_SFLOAT: case VK_FORMAT_R32G32B32A32_SINT: case VK_FORMAT_R32G32B32A32_UINT: return 16;
+	default: return 0;
+	}
+}
 
-	auto type_format = [](SPIRType::BaseType type, uint vecsize)
+static void mk_vertex_input_layout_desc(PipelineDesc& desc, PipelineState const& state, ShaderModule const& vs)
+{
+	//each attribute is appended to its stream, a stream's stride is the sum of its attribute sizes
+	uint strides[MAX_VERTEX_STREAMS] = {};
+	uint nstreams = 1;
+	uint count = std::min((uint)vs.inputs.size(), (uint)MAX_VERTEX_INPUTS);
+	for (uint i = 0; i < count; ++i)
 	{
-		uint format = 98;
-		switch (vecsize)
-		{
-		case 4:	format += 3;
-		case 3:	format += 3;
-		case 2: format += 3;
-		}
-		switch (type)
+		auto& in = vs.inputs[i];
+		uint location = std::min(in.location, (uint)MAX_VERTEX_INPUTS - 1);
+		VkFormat format = state.format[location] ? VkFormat(state.format[location]) : in.format;
+		uint size = state.format[location] ? FormatSize(format) : in.size;
+		if (!size)
 		{
-		case SPIRType::Float: format++;
-		case SPIRType::Int: format++;
+			printf("[PIPELINE ERROR] vertex format %d at location %u has no known size, using the reflected format\n", format, in.location);
+			format = in.format;
+			size = in.size;
 		}
-		return VkFormat(format);
-	};
-
-	auto info	 = new VkPipelineVertexInputStateCreateInfo{ VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
-	auto binding = new VkVertexInputBindingDescription{};
-	auto attribs = new VkVertexInputAttributeDescription[res.stage_inputs.size()]{};
-
-	vector<Resource*> inputs(res.stage_inputs.size());
-	for (auto& in : res.stage_inputs)
-		inputs[comp.get_decoration(in.id, spv::DecorationLocation)] = &in;
-
-	for (auto in : inputs)
-	{
-		SPIRType type = comp.get_type(in->type_id);
-		auto location = comp.get_decoration(in->id, spv::DecorationLocation);
-		attribs[location].location = location;
-		attribs[location].offset = binding->stride;
-		attribs[location].format = type_format(type.basetype, type.vecsize);
-		binding->stride += type_stride(type.basetype) * type.vecsize;
+		uint stream = std::min((uint)state.stream[location], (uint)MAX_VERTEX_STREAMS - 1);
+		desc.attribs[i].binding = stream;
+		desc.attribs[i].location = in.location;
+		desc.attribs[i].offset = strides[stream];
+		desc.attribs[i].format = format;
+		strides[stream] += size;
+		nstreams = std::max(nstreams, stream + 1);
 	}
 
-	info->pVertexAttributeDescriptions = attribs;
-	info->pVertexBindingDescriptions = binding;
-	info->vertexBindingDescriptionCount = 1;
-	info->vertexAttributeDescriptionCount = (uint)res.stage_inputs.size();
-	return info;
+	for (uint i = 0; i < nstreams; ++i)
+		desc.bindings[i] = { i, strides[i], VK_VERTEX_INPUT_RATE_VERTEX };
+
+	desc.input = { VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
+	desc.input.pVertexAttributeDescriptions = desc.attribs;
+	desc.input.pVertexBindingDescriptions = desc.bindings;
+	desc.input.vertexBindingDescriptionCount = nstreams;
+	desc.input.vertexAttributeDescriptionCount = count;
 }
 
-static VkPipelineInputAssemblyStateCreateInfo* mk_assembler_create_info(VkPrimitiveTopology topology)
+static void mk_assembler_create_info(VkPipelineInputAssemblyStateCreateInfo& info, VkPrimitiveTopology topology)
 {
-	auto info = new VkPipelineInputAssemblyStateCreateInfo{};
-	info->sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	info->topology = topology;
-	return info;
+	info = { VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
+	info.topology = topology;
 }
 
-static VkPipelineViewportStateCreateInfo* mk_viewport_state_create_info(VkExtent2D extent)
+static void mk_viewport_state_create_info(VkPipelineViewportStateCreateInfo& info)
 {
-	auto viewport = new VkViewport{};
-	auto scissor = new VkRect2D{};
-
-	viewport->width		= (float)extent.width;
-	viewport->height	= (float)extent.height;
-	viewport->maxDepth = 1.f;
-
-	scissor->extent = extent;
-
-	auto info = new VkPipelineViewportStateCreateInfo{};
-	info->sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-	info->viewportCount = 1;
-	info->scissorCount = 1;
-	info->pScissors = scissor;
-	info->pViewports = viewport;
+	//viewport and scissor are dynamic, set per frame by the renderer
+	info = { VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO };
+	info.viewportCount = 1;
+	info.scissorCount = 1;
+}
 
-	return info;
+static void mk_dynamic_state_create_info(VkPipelineDynamicStateCreateInfo& info)
+{
+	static const VkDynamicState states[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+	info = { VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO };
+	info.dynamicStateCount = sizeof(states) / sizeof(VkDynamicState);
+	info.pDynamicStates = states;
 }
 
-static VkPipelineRasterizationStateCreateInfo* mk_rasterizer_create_info(VkPolygonMode mode, int cull)
+static void mk_rasterizer_create_info(VkPipelineRasterizationStateCreateInfo& info, VkPolygonMode mode, int cull)
 {
-	auto info = new VkPipelineRasterizationStateCreateInfo{ VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
-	info->polygonMode = mode;
-	info->lineWidth = 1.f;
-	info->frontFace = VK_FRONT_FACE_CLOCKWISE;
-	info->cullMode = cull ? VK_CULL_MODE_BACK_BIT : VK_CULL_MODE_NONE;
-	return info;
+	info = { VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO };
+	info.polygonMode = mode;
+	info.lineWidth = 1.f;
+	info.frontFace = VK_FRONT_FACE_CLOCKWISE;
+	info.cullMode = cull ? VK_CULL_MODE_BACK_BIT : VK_CULL_MODE_NONE;
 }
 
-static VkPipelineMultisampleStateCreateInfo* mk_ms_create_info(uint ms)
+static void mk_ms_create_info(VkPipelineMultisampleStateCreateInfo& info, uint ms, int depth)
 {
-	auto info = new VkPipelineMultisampleStateCreateInfo{ VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
-	info->rasterizationSamples = VkSampleCountFlagBits(ms);
-	info->sampleShadingEnable = ms > 1;
-	return info;
+	info = { VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO };
+	info.rasterizationSamples = VkSampleCountFlagBits(ms);
+	info.sampleShadingEnable = ms > 1 && depth != DEPTH_ONLY;
 }
 
-static VkPipelineDepthStencilStateCreateInfo* mk_dss_create_info(int depth)
+static void mk_dss_create_info(VkPipelineDepthStencilStateCreateInfo& info, int depth)
 {
-	auto info = new VkPipelineDepthStencilStateCreateInfo{ VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
-	info->depthTestEnable = depth;
-	info->depthWriteEnable = 1;
-	info->depthCompareOp = VK_COMPARE_OP_LESS;
-	return info;
+	info = { VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO };
+	info.depthTestEnable = depth != DEPTH_OFF;
+	info.depthWriteEnable = depth != DEPTH_EQUAL;
+	info.depthCompareOp = depth == DEPTH_EQUAL ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS;
 }
 
-static VkPipelineColorBlendStateCreateInfo* mk_blend_state_create_info(int blend)
+static void mk_blend_state_create_info(VkPipelineColorBlendStateCreateInfo& info, VkPipelineColorBlendAttachmentState& attachment, int blend, int depth)
 {
-	auto info = new VkPipelineColorBlendStateCreateInfo{};
-	auto attachment = new VkPipelineColorBlendAttachmentState{};
-	info->sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-	info->attachmentCount = 1;
-	info->pAttachments = attachment;
-	attachment->colorWriteMask = VK_COLOR_COMPONENT_R_BIT |
+	info = { VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO };
+	info.attachmentCount = 1;
+	info.pAttachments = &attachment;
+	attachment = {};
+	if (depth == DEPTH_ONLY)
+		return;
+	attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT |
 		VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
 
-	if (!blend) return info;
+	if (!blend) return;
 
-	attachment->blendEnable = 1;
-	attachment->srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-	attachment->dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-	attachment->colorBlendOp = VK_BLEND_OP_ADD;
-	attachment->srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-	attachment->dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-	attachment->alphaBlendOp = VK_BLEND_OP_ADD;
-
-	return info;
+	attachment.blendEnable = 1;
+	attachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+	attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+	attachment.colorBlendOp = VK_BLEND_OP_ADD;
+	attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+	attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+	attachment.alphaBlendOp = VK_BLEND_OP_ADD;
 }
 
-static void FillPipelineInfo(Pipeline* pipe, Compiler& comp, ShaderResources& res, PipelineCreateInfo& createInfo, VkExtent2D extent, uint ms)
+static void FillPipelineInfo(PipelineDesc& desc, PipelineState const& state, ShaderModule const& vs, ShaderModule const& ps, VkPipelineLayout layout, VkRenderPass pass)
 {
-	pipe->info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipe->info.stageCount = 2;
-	pipe->info.pStages = mk_pss_create_info(createInfo);
-	pipe->info.pVertexInputState = mk_vertex_input_layout_desc(comp, res);
-	pipe->info.pInputAssemblyState = mk_assembler_create_info(createInfo.topolgy);
-	pipe->info.pViewportState = mk_viewport_state_create_info(extent);
-	pipe->info.pRasterizationState = mk_rasterizer_create_info(createInfo.mode, createInfo.cull);
-	pipe->info.pMultisampleState = mk_ms_create_info(ms);
-	pipe->info.pDepthStencilState = mk_dss_create_info(createInfo.depth);
-	pipe->info.pColorBlendState = mk_blend_state_create_info(createInfo.blend);
+	mk_pss_create_info(desc, state, vs, ps);
+	mk_vertex_input_layout_desc(desc, state, vs);
+	mk_assembler_create_info(desc.assembly, VkPrimitiveTopology(state.topology));
+	mk_viewport_state_create_info(desc.viewport);
+	mk_dynamic_state_create_info(desc.dynamic);
+	mk_rasterizer_create_info(desc.raster, VkPolygonMode(state.mode), state.cull);
+	mk_ms_create_info(desc.multisample, state.ms, state.depth);
+	mk_dss_create_info(desc.depth, state.depth);
+	mk_blend_state_create_info(desc.blend, desc.attachment, state.blend, state.depth);
+
+	desc.info = { VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO };
+	desc.info.stageCount = 2;
+	desc.info.pStages = desc.stages;
+	desc.info.pVertexInputState = &desc.input;
+	desc.info.pInputAssemblyState = &desc.assembly;
+	desc.info.pViewportState = &desc.viewport;
+	desc.info.pDynamicState = &desc.dynamic;
+	desc.info.pRasterizationState = &desc.raster;
+	desc.info.pMultisampleState = &desc.multisample;
+	desc.info.pDepthStencilState = &desc.depth;
+	desc.info.pColorBlendState = &desc.blend;
+	desc.info.layout = layout;
+	desc.info.renderPass = pass;
 }
 
-static void UpdatePipelineAndDestroy(Pipeline* pipe, VkExtent2D extent, uint ms)
+static PipelineState MkPipelineState(PipelineCreateInfo const& info, Shader const& vs, Shader const& ps, uint ms)
 {
-	auto viewport = (VkViewport*)pipe->info.pViewportState->pViewports;
-	auto scissor  = (VkRect2D*)pipe->info.pViewportState->pScissors;
-	viewport->width = (float)extent.width;
-	viewport->height = (float)extent.height;
-	scissor->extent = extent;
-	auto msState = (VkPipelineMultisampleStateCreateInfo*)pipe->info.pMultisampleState;
-	msState->rasterizationSamples = VkSampleCountFlagBits(ms);
-	msState->sampleShadingEnable = ms > 1;
-	DestroyPipeline(pipe->handle);
+	PipelineState state = {};
+	state.vs = vs.hash;
+	state.ps = ps.hash;
+	state.ms = ms;
+	state.topology = info.topolgy;
+	state.mode = info.mode;
+	state.cull = info.cull;
+	state.depth = info.depth;
+	state.blend = info.blend;
+	for (uint i = 0; i < info.vertex.size() && i < MAX_VERTEX_INPUTS; ++i)
+	{
+		state.format[i] = info.vertex[i].format;
+		state.stream[i] = info.vertex[i].stream;
+	}
+	return state;
 }
 
-void PipelineManager::CreatePipelines(vector<PipelineCreateInfo> infos, VkRenderPass pass, VkExtent2D extent, uint ms)
+//watches the shader directory and rebuilds affected pipelines on its own serial queue,
+//the render thread only ever sees finished pipelines through PipelineManager::Update
+struct ShaderWatcher : mango::filesystem::FileObserver
 {
-	auto load_spirv_from_file = [](const char* path, shaderc_shader_kind shader_type)
+	PipelineManager*	pipes;
+	mango::SerialQueue	queue;
+
+	ShaderWatcher(PipelineManager* pipes) : pipes(pipes)
 	{
-		string spath = "shaders\\";
-		spath += path;
-		std::ifstream code(spath);
-		std::string byteCode((std::istreambuf_iterator<char>(code)), std::istreambuf_iterator<char>());
-		code.close();
-		shaderc::Compiler compiler;
-		shaderc::CompileOptions options;
-		options.SetOptimizationLevel(shaderc_optimization_level_performance);
-		auto pp = compiler.PreprocessGlsl(byteCode, shader_type, spath.data(), options);
-		auto compiling = compiler.CompileGlslToSpv(byteCode, shader_type, spath.data(), options);
-		auto msg = compiling.GetErrorMessage();
-		if(msg.size()) printf("[SPIRV ERROR]\n%s\n", msg.data());
-		return vector<uint>(compiling.cbegin(), compiling.cend());
-	};
+		start(SHADER_DIR);
+	}
 
-	auto ParseUniforms = [this](vector<std::pair<VkDescriptorType, SmallVector<Resource>*>>&& uniforms, CompilerGLSL& comp, VkShaderStageFlagBits stage)
+	void onEvent(mango::u32 flags, const std::string& filename) override
 	{
-		for (auto& pair : uniforms)
+		if ((flags & DIRECTORY) || filename.find(".spv") != string::npos)
+			return;
+		queue.enqueue([this, filename] { pipes->Reload(filename); });
+	}
+};
+
+void PipelineManager::CreatePipelines(vector<PipelineCreateInfo> infos, VkRenderPass pass, uint ms)
+{
+	this->ms = ms;
+	this->pass = pass;
+	auto ParseUniforms = [this](Shader& shader)
+	{
+		for (auto& in : shader.bindings)
 		{
-			for (auto& in : *pair.second)
-			{
-				uint set = comp.get_decoration(in.id, spv::DecorationDescriptorSet);
-				uint binding = comp.get_decoration(in.id, spv::DecorationBinding);
-				if (descLayouts.size() <= set) descLayouts.resize(set + 1);
-				auto& layout = descLayouts[set];
-				layout.idx = set;
-				if (layout.bindings.size() <= binding)
-					layout.bindings.resize(binding + 1);
-				layout.bindings[binding].type = pair.first;
-				layout.bindings[binding].stage |= stage;
-			}
+			if (descLayouts.size() <= in.set) descLayouts.resize(in.set + 1);
+			auto& layout = descLayouts[in.set];
+			layout.idx = in.set;
+			if (layout.bindings.size() <= in.binding)
+				layout.bindings.resize(in.binding + 1);
+			layout.bindings[in.binding].type = in.type;
+			layout.bindings[in.binding].stage |= shader.stage;
 		}
 	};
 
+	//compile and reflect every distinct stage on the worker pool, each slot is written by exactly one task
+	unordered_map<string, Shader> shaders;
 	for (auto& info : infos)
 	{
-		string vs = info.shader;
-		string ps = info.shader;
-		vs += ".vert";
-		ps += ".frag";
-		info.vs = load_spirv_from_file(vs.data(), shaderc_vertex_shader);
-		info.ps = load_spirv_from_file(ps.data(), shaderc_fragment_shader);
-		CompilerGLSL comp_vs(info.vs);
-		CompilerGLSL comp_ps(info.ps);
-		ShaderResources res_vs = comp_vs.get_shader_resources();
-		ShaderResources res_ps = comp_ps.get_shader_resources();
+		if (info.compute)
+		{
+			shaders[string(info.shader) + ".comp"].stage = VK_SHADER_STAGE_COMPUTE_BIT;
+			continue;
+		}
+		shaders[string(info.shader) + ".vert"].stage = VK_SHADER_STAGE_VERTEX_BIT;
+		shaders[string(info.shader) + ".frag"].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+	}
+	{
+		mango::ConcurrentQueue queue;
+		for (auto& shader : shaders)
+			queue.enqueue([&shader] { shader.second = Shader::Load(shader.first.data(), shader.second.stage); });
+		queue.wait();
+	}
+
+	pipelines.resize(std::size(builtinPipelines));
+	for (uint i = 0; i < std::size(builtinPipelines); ++i)
+		pipelineIds[builtinPipelines[i]] = i;
+
+	for (auto& info : infos)
+	{
+		if (info.compute)
+		{
+			Shader& comp = shaders[string(info.shader) + ".comp"];
+			AddShader(comp);
+			ParseUniforms(comp);
+			computeIds[info.shader] = computes.size();
+			computes.push_back(new ComputePipeline{ 0, info.shader, comp.hash });
+			continue;
+		}
+		Shader& vert = shaders[string(info.shader) + ".vert"];
+		Shader& frag = shaders[string(info.shader) + ".frag"];
+		AddShader(vert);
+		AddShader(frag);
 		Pipeline* pipe = new Pipeline{};
-		pipelines[info.shader] = pipe;
-		ParseUniforms({
-			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &res_vs.uniform_buffers},
-			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &res_vs.storage_buffers },
-			}, comp_vs, VK_SHADER_STAGE_VERTEX_BIT);
-		ParseUniforms({
-			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &res_ps.uniform_buffers},
-			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &res_ps.storage_buffers },
-			{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &res_ps.storage_images},
-			{ VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, &res_ps.subpass_inputs},
-			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &res_ps.sampled_images}
-			}, comp_ps, VK_SHADER_STAGE_FRAGMENT_BIT);
-		FillPipelineInfo(pipe, comp_vs, res_vs, info, extent, ms);
+		pipe->shader = info.shader;
+		pipe->permutation = info.permutation;
+		pipe->state = MkPipelineState(info, vert, frag, ms);
+		auto id = pipelineIds.emplace(info.shader, (uint)pipelines.size());
+		if (id.second)
+			pipelines.push_back(pipe);
+		else
+			pipelines[id.first->second] = pipe;
+		ParseUniforms(vert);
+		ParseUniforms(frag);
 	}
 
+	CreateLayouts();
+
+	for (uint i = 0; i < std::size(builtinPipelines); ++i)
+		if (!pipelines[i])
+			printf("[PIPELINE ERROR] built-in pipeline %s has no create info\n", builtinPipelines[i]);
+
+	vector<Pipeline*> build;
+	for (auto pipeline : pipelines)
+		if (pipeline)
+			build.push_back(pipeline);
+	BuildPipelines(build);
+	for (auto compute : computes)
+		compute->handle = FindCompute(compute->cs);
+	watcher = new ShaderWatcher(this);
+}
+
+void PipelineManager::CreateLayouts()
+{
 	vector<VkDescriptorSetLayout> tmp_layouts;
 	for (auto& layout : descLayouts)
 	{
+		layout.push = pushSet == (int)tmp_layouts.size();
 		layout.Init();
 		tmp_layouts.push_back(layout.handle);
 	}
 
-	VkPushConstantRange range = { 17, 0, 256 };
+	VkPushConstantRange range = { pushStages, 0, 256 };
 	VkPipelineLayoutCreateInfo layoutinfo = { VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
 	layoutinfo.setLayoutCount = (uint)tmp_layouts.size();
 	layoutinfo.pSetLayouts	  = tmp_layouts.data();
 	layoutinfo.pushConstantRangeCount = 1;
 	layoutinfo.pPushConstantRanges = &range;
 	layout = CreatePipelineLayout(&layoutinfo);
+}
 
-	vector<VkGraphicsPipelineCreateInfo> pipelineCreateInfos;
-	for (auto& pipeline : pipelines) {
-		pipeline.second->info.layout = layout;
-		pipeline.second->info.renderPass = pass;
-		pipelineCreateInfos.push_back(pipeline.second->info);
-	}
-
-	vector<VkPipeline> tmp_pipelines(pipelineCreateInfos.size());
+void PipelineManager::DestroyLayouts()
+{
+	for (auto& set : descLayouts)
+		set.Destroy();
+	DestroyPipelineLayout(layout);
+	layout = 0;
+}
 
-	CreateGraphicsPipelines(0, (uint)pipelineCreateInfos.size(), pipelineCreateInfos.data(), tmp_pipelines.data());
-	uint i = 0;
+void PipelineManager::SetPushSet(int set)
+{
+	//waits for reloads still building against the old layout
+	std::unique_lock<std::shared_mutex> rebuild(rebuildLock);
+	std::lock_guard<std::mutex> lock(reloadLock);
+	pushSet = set < (int)descLayouts.size() ? set : -1;
+	printf("Recreating layouts, push descriptor set %d\n", pushSet);
+	DestroyRetired(true);
+	//every pipeline and pending reload was built against the old pipeline layout
+	{
+		std::lock_guard<std::mutex> lock(stateLock);
+		generation++;
+		DestroyLayouts();
+		CreateLayouts();
+		for (auto& state : states)
+			DestroyPipeline(state.second);
+		for (auto& state : computeStates)
+			DestroyPipeline(state.second);
+		states.clear();
+		computeStates.clear();
+	}
+	reloaded.clear();
+	reloadedCompute.clear();
+	vector<Pipeline*> build;
 	for (auto pipeline : pipelines)
-		pipeline.second->handle = tmp_pipelines[i++];
+	{
+		if (!pipeline)
+			continue;
+		pipeline->variants.clear();
+		build.push_back(pipeline);
+	}
+	BuildPipelines(build);
+	for (auto compute : computes)
+		compute->handle = FindCompute(compute->cs);
 }
 
-void PipelineManager::Recreate(VkRenderPass pass, VkExtent2D extent, uint ms)
+void PipelineManager::Recreate(VkRenderPass pass, uint ms)
 {
 	printf("Recreating pipelines\n");
-	vector<VkGraphicsPipelineCreateInfo> pipelineCreateInfos;
-	for (auto& pipeline : pipelines) {
-		UpdatePipelineAndDestroy(pipeline.second, extent, ms);
-		pipeline.second->info.renderPass = pass;
-		pipelineCreateInfos.push_back(pipeline.second->info);
+	//waits for reloads still building against the old pass
+	std::unique_lock<std::shared_mutex> rebuild(rebuildLock);
+	std::lock_guard<std::mutex> lock(reloadLock);
+	//pending reloads were built for the old pass and sample count, or are about to be destroyed
+	reloaded.clear();
+	reloadedCompute.clear();
+	DestroyRetired(true);
+	{
+		std::lock_guard<std::mutex> lock(stateLock);
+		generation++;
+		this->ms = ms;
+		this->pass = pass;
+		for (auto& state : states)
+			DestroyPipeline(state.second);
+		states.clear();
 	}
-	vector<VkPipeline> tmp_pipelines(pipelineCreateInfos.size());
-	CreateGraphicsPipelines(0, (uint)pipelineCreateInfos.size(), pipelineCreateInfos.data(), tmp_pipelines.data());
-	uint i = 0;
-	for (auto pipeline : pipelines)
-		pipeline.second->handle = tmp_pipelines[i++];
+	vector<Pipeline*> build;
+	for (auto pipeline : pipelines) {
+		if (!pipeline)
+			continue;
+		pipeline->state.ms = ms;
+		pipeline->variants.clear();
+		build.push_back(pipeline);
+	}
+	BuildPipelines(build);
+}
+
+void PipelineManager::Destroy()
+{
+	//no reload may run once the pipelines and layouts are gone
+	watcher->stop();
+	watcher->queue.cancel();
+	watcher->queue.wait();
+	delete watcher;
+	watcher = 0;
+
+	std::lock_guard<std::mutex> lock(reloadLock);
+	reloaded.clear();
+	reloadedCompute.clear();
+	DestroyRetired(true);
+	{
+		std::lock_guard<std::mutex> lock(stateLock);
+		for (auto& state : states)
+			DestroyPipeline(state.second);
+		for (auto& state : computeStates)
+			DestroyPipeline(state.second);
+		states.clear();
+		computeStates.clear();
+	}
+}
+
+void PipelineManager::AddShader(Shader const& shader)
+{
+	std::lock_guard<std::mutex> lock(stateLock);
+	auto& module = modules[shader.hash];
+	if (module.handle)
+		return;
+	VkShaderModuleCreateInfo info = { VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO };
+	info.pCode = shader.spirv.data();
+	info.codeSize = shader.spirv.size() * sizeof(uint);
+	module.handle = CreateShaderModule(&info);
+	module.inputs = shader.inputs;
+}
+
+VkPipeline PipelineManager::FindPipeline(PipelineState const& state, uint started)
+{
+	PipelineDesc desc;
+	{
+		std::lock_guard<std::mutex> lock(stateLock);
+		if (started != -1 && started != generation)
+			return 0;
+		auto it = states.find(state);
+		if (it != states.end())
+			return it->second;
+		FillPipelineInfo(desc, state, modules[state.vs], modules[state.ps], layout, pass);
+	}
+
+	VkPipeline handle;
+	CreateGraphicsPipelines(cache, 1, &desc.info, &handle);
+
+	//another thread may have built the same state meanwhile, keep the first one
+	std::lock_guard<std::mutex> lock(stateLock);
+	//a rebuild cleared the cache since the reload began, its state may carry the old sample count
+	if (started != -1 && started != generation)
+	{
+		DestroyPipeline(handle);
+		return 0;
+	}
+	auto inserted = states.emplace(state, handle);
+	if (!inserted.second)
+		DestroyPipeline(handle);
+	return inserted.first->second;
+}
+
+PipelineHandle PipelineManager::Resolve(const char* shader)
+{
+	auto it = pipelineIds.find(shader);
+	if (it == pipelineIds.end() || !pipelines[it->second])
+	{
+		printf("[PIPELINE ERROR] no pipeline named %s\n", shader);
+		return {};
+	}
+	return { it->second };
+}
+
+ComputeHandle PipelineManager::ResolveCompute(const char* shader)
+{
+	auto it = computeIds.find(shader);
+	if (it == computeIds.end())
+	{
+		printf("[PIPELINE ERROR] no compute pipeline named %s\n", shader);
+		return {};
+	}
+	return { it->second };
+}
+
+VkPipeline PipelineManager::FindCompute(uint64 cs, uint started)
+{
+	VkComputePipelineCreateInfo info = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+	{
+		std::lock_guard<std::mutex> lock(stateLock);
+		if (started != -1 && started != generation)
+			return 0;
+		auto it = computeStates.find(cs);
+		if (it != computeStates.end())
+			return it->second;
+		info.stage = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO };
+		info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+		info.stage.module = modules[cs].handle;
+		info.stage.pName = "main";
+		info.layout = layout;
+	}
+
+	VkPipeline handle;
+	CreateComputePipelines(cache, 1, &info, &handle);
+
+	std::lock_guard<std::mutex> lock(stateLock);
+	if (started != -1 && started != generation)
+	{
+		DestroyPipeline(handle);
+		return 0;
+	}
+	auto inserted = computeStates.emplace(cs, handle);
+	if (!inserted.second)
+		DestroyPipeline(handle);
+	return inserted.first->second;
 }
 
+void PipelineManager::Reload(string const& filename)
+{
+	//anything that is not a stage source (an include, or an event without a name) reloads everything,
+	//pipelines whose stage hashes did not change are skipped below
+	size_t dot = filename.rfind('.');
+	string ext = dot == string::npos ? "" : filename.substr(dot);
+	string stem = filename.substr(0, dot);
+	bool all = ext != ".vert" && ext != ".frag" && ext != ".comp";
+
+	vector<std::pair<Pipeline*, PipelineState>> targets;
+	vector<std::pair<ComputePipeline*, uint64>> computeTargets;
+	uint started;
+	{
+		std::shared_lock<std::shared_mutex> building(rebuildLock);
+		std::lock_guard<std::mutex> lock(reloadLock);
+		started = generation;
+		for (auto pipeline : pipelines)
+			if (pipeline && (all || stem == pipeline->shader))
+				targets.push_back({ pipeline, pipeline->state });
+		for (auto compute : computes)
+			if (all || stem == compute->shader)
+				computeTargets.push_back({ compute, compute->cs });
+	}
+
+	for (auto& [pipe, cs] : computeTargets)
+	{
+		Shader comp = Shader::Load((string(pipe->shader) + ".comp").data(), VK_SHADER_STAGE_COMPUTE_BIT);
+		if (comp.spirv.empty() || comp.hash == cs)
+			continue;
+		AddShader(comp);
+		//compiling above ran unlocked, only building and queueing the swap keeps a rebuild waiting
+		std::shared_lock<std::shared_mutex> building(rebuildLock);
+		VkPipeline handle = FindCompute(comp.hash, started);
+		if (!handle)
+			return;
+		std::lock_guard<std::mutex> lock(reloadLock);
+		reloadedCompute.push_back({ pipe, comp.hash, handle });
+	}
+
+	for (auto& [pipe, state] : targets)
+	{
+		Shader vert = Shader::Load((string(pipe->shader) + ".vert").data(), VK_SHADER_STAGE_VERTEX_BIT);
+		Shader frag = Shader::Load((string(pipe->shader) + ".frag").data(), VK_SHADER_STAGE_FRAGMENT_BIT);
+		if (vert.spirv.empty() || frag.spirv.empty())
+			continue;
+		if (vert.hash == state.vs && frag.hash == state.ps)
+			continue;
+
+		AddShader(vert);
+		AddShader(frag);
+		state.vs = vert.hash;
+		state.ps = frag.hash;
+		std::shared_lock<std::shared_mutex> building(rebuildLock);
+		VkPipeline handle = FindPipeline(state, started);
+		if (!handle)
+			return;
+		std::lock_guard<std::mutex> lock(reloadLock);
+		reloaded.push_back({ pipe, state, handle });
+	}
+}
+
+void PipelineManager::Update()
+{
+	//replaced pipelines leave the state cache at once and are destroyed when the frames recorded with them are done
+	std::lock_guard<std::mutex> lock(reloadLock);
+	frame++;
+	vector<VkPipeline> old;
+	for (auto& swap : reloaded)
+	{
+		auto pipe = swap.pipe;
+		old.push_back(pipe->handle);
+		for (auto& variant : pipe->variants)
+			old.push_back(variant.second);
+		pipe->state.vs = swap.state.vs;
+		pipe->state.ps = swap.state.ps;
+		pipe->handle = swap.handle;
+		pipe->variants.clear();
+		printf("Reloaded %s\n", pipe->shader);
+	}
+	for (auto& swap : reloadedCompute)
+	{
+		old.push_back(swap.pipe->handle);
+		swap.pipe->cs = swap.cs;
+		swap.pipe->handle = swap.handle;
+		printf("Reloaded %s\n", swap.pipe->shader);
+	}
+
+	//a reload can find a pipeline in the cache just before an earlier swap retires it, take it back
+	for (auto& swap : reloaded)
+		for (uint i = 0; i < retired.size(); ++i)
+			if (retired[i].handle == swap.handle)
+			{
+				std::lock_guard<std::mutex> lock(stateLock);
+				states.emplace(swap.state, swap.handle);
+				retired.erase(retired.begin() + i--);
+			}
+	for (auto& swap : reloadedCompute)
+		for (uint i = 0; i < retired.size(); ++i)
+			if (retired[i].handle == swap.handle)
+			{
+				std::lock_guard<std::mutex> lock(stateLock);
+				computeStates.emplace(swap.cs, swap.handle);
+				retired.erase(retired.begin() + i--);
+			}
+	reloaded.clear();
+	reloadedCompute.clear();
+
+	for (auto handle : old)
+		Retire(handle);
+	DestroyRetired(false);
+}
+
+void PipelineManager::Retire(VkPipeline handle)
+{
+	//identical states share one VkPipeline, another pipeline or variant may still bind it
+	for (auto pipe : pipelines)
+	{
+		if (!pipe)
+			continue;
+		if (pipe->handle == handle)
+			return;
+		for (auto& variant : pipe->variants)
+			if (variant.second == handle)
+				return;
+	}
+	for (auto compute : computes)
+		if (compute->handle == handle)
+			return;
+	for (auto& r : retired)
+		if (r.handle == handle)
+			return;
+
+	std::lock_guard<std::mutex> lock(stateLock);
+	std::erase_if(states, [handle](auto const& state) { return state.second == handle; });
+	std::erase_if(computeStates, [handle](auto const& state) { return state.second == handle; });
+	retired.push_back({ handle, frame });
+}
+
+void PipelineManager::DestroyRetired(bool all)
+{
+	//Update runs before the frame waits for its fence, a handle last recorded the frame before it was retired
+	//is only known to be done NFRAMES + 1 updates later
+	std::erase_if(retired, [this, all](RetiredPipeline const& r)
+	{
+		if (!all && frame - r.frame <= NFRAMES)
+			return false;
+		DestroyPipeline(r.handle);
+		return true;
+	});
+}
+
+VkPipeline PipelineManager::GetVariant(Pipeline* pipe, uint64 key)
+{
+	if (!key)
+		return pipe->handle;
+	auto it = pipe->variants.find(key);
+	if (it != pipe->variants.end())
+		return it->second;
+
+	//first use of this permutation on this pipeline, unpack the key into specialization constants
+	PipelineState state = pipe->state;
+	if (key & VARIANT_DEPTH_EQUAL)
+		state.depth = DEPTH_EQUAL;
+	state.nspec = std::min((uint)pipe->permutation.size(), (uint)MAX_SPEC_CONSTANTS);
+	uint shift = 0;
+	for (uint i = 0; i < state.nspec; ++i)
+	{
+		uint bits = pipe->permutation[i];
+		state.spec[i] = uint((key >> shift) & ((1ull << bits) - 1));
+		shift += bits;
+	}
+	return pipe->variants[key] = FindPipeline(state);
+}
+
+void PipelineManager::BuildPipelines(vector<Pipeline*> const& build)
+{
+	//one batch per worker, they all feed the same pipeline cache which the driver synchronizes internally
+	uint nthreads = std::max(mango::ThreadPool::getInstance().size(), 1);
+	uint batch = std::max<uint>(((uint)build.size() + nthreads - 1) / nthreads, 1);
+	mango::ConcurrentQueue queue;
+	for (uint first = 0; first < build.size(); first += batch)
+	{
+		queue.enqueue([this, &build, first, batch]
+		{
+			uint count = std::min<uint>(batch, (uint)build.size() - first);
+			vector<PipelineDesc> descs(count);
+			vector<VkGraphicsPipelineCreateInfo> infos;
+			vector<Pipeline*> missing;
+			{
+				std::lock_guard<std::mutex> lock(stateLock);
+				for (uint i = 0; i < count; ++i)
+				{
+					auto pipe = build[first + i];
+					auto it = states.find(pipe->state);
+					if (it != states.end())
+					{
+						pipe->handle = it->second;
+						continue;
+					}
+					auto& desc = descs[missing.size()];
+					FillPipelineInfo(desc, pipe->state, modules[pipe->state.vs], modules[pipe->state.ps], layout, pass);
+					infos.push_back(desc.info);
+					missing.push_back(pipe);
+				}
+			}
+			if (missing.empty())
+				return;
+
+			vector<VkPipeline> handles(missing.size());
+			CreateGraphicsPipelines(cache, (uint)infos.size(), infos.data(), handles.data());
+			std::lock_guard<std::mutex> lock(stateLock);
+			for (uint i = 0; i < missing.size(); ++i)
+			{
+				auto inserted = states.emplace(missing[i]->state, handles[i]);
+				if (!inserted.second)
+					DestroyPipeline(handles[i]);
+				missing[i]->handle = inserted.first->second;
+			}
+		});
+	}
+	queue.wait();
+}
+
+//prepended to the driver blob so a cache from another gpu or driver is never handed to the driver
+struct PipelineCacheHeader
+{
+	uint	magic;
+	uint	vendorID;
+	uint	deviceID;
+	uint	driverVersion;
+	uint8_t	uuid[VK_UUID_SIZE];
+	uint64	size;
+};
+
+static PipelineCacheHeader MkCacheHeader(uint64 size)
+{
+	auto props = GetPhysicalDeviceProperties();
+	PipelineCacheHeader header = {};
+	header.magic = 0x43504b56;
+	header.vendorID = props.vendorID;
+	header.deviceID = props.deviceID;
+	header.driverVersion = props.driverVersion;
+	memcpy(header.uuid, props.pipelineCacheUUID, VK_UUID_SIZE);
+	header.size = size;
+	return header;
+}
+
+void PipelineManager::LoadCache(const char* path)
+{
+	vector<char> data;
+	std::ifstream file(path, std::ios::binary);
+	PipelineCacheHeader header = {};
+	if (file.read((char*)&header, sizeof(header)))
+	{
+		auto expected = MkCacheHeader(header.size);
+		if (!memcmp(&header, &expected, sizeof(header)))
+		{
+			data.resize(header.size);
+			if (!file.read(data.data(), data.size()))
+				data.clear();
+		}
+		else printf("Discarding pipeline cache %s, device or driver changed\n", path);
+	}
+
+	VkPipelineCacheCreateInfo info = { VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+	info.initialDataSize = data.size();
+	info.pInitialData = data.data();
+	cache = CreatePipelineCache(&info);
+}
+
+void PipelineManager::SaveCache(const char* path)
+{
+	size_t size = 0;
+	GetPipelineCacheData(cache, &size, 0);
+	vector<char> data(size);
+	GetPipelineCacheData(cache, &size, data.data());
+	auto header = MkCacheHeader(size);
+
+	//write next to the old file and swap it in, so a crash mid-write never leaves a torn cache
+	string tmp = path;
+	tmp += ".tmp";
+	{
+		std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+		file.write((char*)&header, sizeof(header));
+		file.write(data.data(), size);
+		if (!file)
+		{
+			printf("Failed to write pipeline cache %s\n", tmp.data());
+			return;
+		}
+	}
+	std::error_code err;
+	std::filesystem::rename(tmp, path, err);
+	if (err)
+		printf("Failed to replace pipeline cache %s: %s\n", path, err.message().data());
+}
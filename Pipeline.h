@@ -3,6 +3,62 @@
 #include "Device.h"
 #include "Bindable.h"
 #include "Descriptor.h"
+#include "Shader.h"
+#include "mutex"
+#include "shared_mutex"
+
+#define PIPELINE_CACHE_PATH "pipeline.cache"
+
+//index into PipelineManager::pipelines, resolved once from the shader name and then used on every bind
+struct PipelineHandle
+{
+	uint id = -1;
+	operator bool() const { return id != -1; }
+};
+
+struct ComputeHandle
+{
+	uint id = -1;
+	operator bool() const { return id != -1; }
+};
+
+//pipelines the renderer draws with itself, they get these ids whatever order their create infos come in
+inline constexpr const char* builtinPipelines[] = { "shader1", "depth" };
+
+//consteval, so a name missing from the registry fails to compile instead of resolving at run time
+consteval PipelineHandle BuiltinPipeline(const char* name)
+{
+	for (uint i = 0; i < std::size(builtinPipelines); ++i)
+	{
+		const char* a = builtinPipelines[i];
+		const char* b = name;
+		while (*a && *a == *b) ++a, ++b;
+		if (*a == *b)
+			return { i };
+	}
+	throw "not a built-in pipeline";
+}
+
+//per-location override of the reflected vertex input, formats may be packed (half floats, 10:10:10:2, 8 bit ints)
+struct VertexAttribute
+{
+	uint		stream;
+	VkFormat	format;
+};
+
+enum DepthMode
+{
+	DEPTH_OFF,
+	// test LESS and write
+	DEPTH_WRITE,
+	// test EQUAL without writing, for the shading pass after a depth pre-pass
+	DEPTH_EQUAL,
+	// test LESS and write with color writes and sample shading off, for the depth pre-pass
+	DEPTH_ONLY,
+};
+
+//set on a variant key to get the same pipeline with DEPTH_EQUAL, the specialization bits are unaffected
+#define VARIANT_DEPTH_EQUAL (1ull << 63)
 
 struct PipelineCreateInfo
 {
@@ -12,20 +68,122 @@ struct PipelineCreateInfo
 	int blend;
 	VkPolygonMode mode = VK_POLYGON_MODE_FILL;
 	VkPrimitiveTopology topolgy = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-	vector<uint> vs, ps;
+	vector<uint> permutation;
+	// indexed by location, empty means one tightly packed stream of the reflected 32 bit types
+	vector<VertexAttribute> vertex;
+	// load <shader>.comp instead of a .vert/.frag pair, the fixed function fields are ignored
+	int compute;
+};
+
+#define MAX_SPEC_CONSTANTS 16
+#define MAX_VERTEX_INPUTS 16
+#define MAX_VERTEX_STREAMS 4
+
+//everything that distinguishes one VkPipeline from another under the shared layout and render pass,
+//hashed and compared as raw bytes so it has to stay free of padding
+struct PipelineState
+{
+	uint64	vs, ps;
+	uint	ms;
+	uint8_t	topology, mode, cull, depth, blend, nspec, pad[6];
+	uint	spec[MAX_SPEC_CONSTANTS];
+	uint	format[MAX_VERTEX_INPUTS];
+	uint8_t	stream[MAX_VERTEX_INPUTS];
+
+	bool operator==(PipelineState const& state) const { return !memcmp(this, &state, sizeof(PipelineState)); }
+};
+
+namespace std
+{
+	template<> struct hash<PipelineState>
+	{
+		inline size_t operator()(PipelineState const& state) const
+		{
+			auto words = (const uint64*)&state;
+			size_t seed = words[0];
+			for (int i = 1; i < sizeof(PipelineState) / sizeof(uint64); ++i)
+				seed ^= words[i] + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+			return seed;
+		}
+	};
+}
+
+struct ShaderModule
+{
+	VkShaderModule		handle;
+	vector<ShaderInput>	inputs;
 };
 
 struct Pipeline
 {
 	VkPipeline handle;
-	VkGraphicsPipelineCreateInfo info;
+	PipelineState state;
+	const char* shader;
+	// bit width of each specialization constant, packed in constant_id order into the variant key
+	vector<uint> permutation;
+	unordered_map<uint64, VkPipeline> variants;
+};
+
+struct ComputePipeline
+{
+	VkPipeline handle;
+	const char* shader;
+	uint64 cs;
+};
+
+//a pipeline rebuilt in the background, waiting to be swapped in at the next frame boundary
+struct PipelineSwap
+{
+	Pipeline* pipe;
+	PipelineState state;
+	VkPipeline handle;
+};
+
+struct ComputeSwap
+{
+	ComputePipeline* pipe;
+	uint64 cs;
+	VkPipeline handle;
+};
+
+//a pipeline swapped out by a reload, destroyed once the frames that may still use it have finished
+struct RetiredPipeline
+{
+	VkPipeline handle;
+	uint64 frame;
 };
 
+struct ShaderWatcher;
+
 struct PipelineManager
 {
-	unordered_map<const char*, Pipeline*>		pipelines;
+	vector<Pipeline*>							pipelines;
+	vector<ComputePipeline*>					computes;
+	unordered_map<string, uint>					pipelineIds;
+	unordered_map<string, uint>					computeIds;
 	vector<DescriptorSetLayout>					descLayouts;
 	VkPipelineLayout							layout;
+	VkRenderPass								pass;
+	VkPipelineCache								cache;
+	uint										ms;
+	std::mutex									stateLock;
+	unordered_map<PipelineState, VkPipeline>	states;
+	unordered_map<uint64, VkPipeline>			computeStates;
+	VkShaderStageFlags							pushStages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+	unordered_map<uint64, ShaderModule>			modules;
+	int											pushSet = PUSH_DESCRIPTOR_SET;
+	ShaderWatcher*								watcher;
+	std::mutex									reloadLock;
+	vector<PipelineSwap>						reloaded;
+	vector<ComputeSwap>							reloadedCompute;
+	// bumped under rebuildLock and stateLock whenever pipelines are rebuilt, reloads started before are dropped
+	uint										generation = 0;
+	// held shared by a background reload while it builds against layout and pass,
+	// exclusively by a rebuild before it replaces or destroys either
+	std::shared_mutex							rebuildLock;
+	vector<RetiredPipeline>						retired;
+	// counts Update calls, which happen once per frame
+	uint64										frame = 0;
 
 	template<Bindable_T...T>
 	VkDescriptorSet FindSet(uint slot, Bindable* head, T*... tail)
@@ -33,12 +191,66 @@ struct PipelineManager
 		return descLayouts[slot].FindSet({ head, tail... });
 	}
 
-	void CreatePipelines(vector<PipelineCreateInfo> infos, VkRenderPass pass, VkExtent2D extent, uint ms);
+	template<Bindable_T...T>
+	void PushSet(CommandBuffer& cmd, VkPipelineBindPoint bindPoint, uint slot, Bindable* head, T*... tail)
+	{
+		descLayouts[slot].Push(cmd, bindPoint, layout, { head, tail... });
+	}
+
+	void CreatePipelines(vector<PipelineCreateInfo> infos, VkRenderPass pass, uint ms);
+
+	// descriptor set layouts and the pipeline layout, the device must be idle
+	void CreateLayouts();
+	void DestroyLayouts();
+
+	// moves the push descriptor slot, -1 for none, rebuilding the layouts and every pipeline, the device must be idle
+	void SetPushSet(int set);
+
+	// only needed when the sample count or render pass changes, the extent is dynamic state,
+	// the old render pass may only be destroyed once this returns
+	void Recreate(VkRenderPass pass, uint ms);
+
+	// stops watching the shader directory and destroys every pipeline, the device must be idle
+	void Destroy();
+
+	void AddShader(Shader const& shader);
+
+	// started is the generation a background reload began in, its result is destroyed and 0 returned
+	// when a rebuild happened since, rebuildLock must then be held shared
+	VkPipeline FindPipeline(PipelineState const& state, uint started = -1);
+
+	VkPipeline FindCompute(uint64 cs, uint started = -1);
+
+	void BuildPipelines(vector<Pipeline*> const& build);
+
+	void Reload(string const& filename);
+
+	void Update();
+
+	// drops a swapped out handle from the state caches unless some pipeline still uses it, reloadLock must be held
+	void Retire(VkPipeline handle);
+
+	// destroys retired pipelines older than the frames in flight, or all of them when the device is idle
+	void DestroyRetired(bool all);
+
+	void LoadCache(const char* path);
+
+	void SaveCache(const char* path);
+
+	// slow path, resolve once and keep the handle
+	PipelineHandle Resolve(const char* shader);
+
+	ComputeHandle ResolveCompute(const char* shader);
+
+	Pipeline* GetPipeline(PipelineHandle handle)
+	{
+		return pipelines[handle.id];
+	}
 
-	void Recreate(VkRenderPass pass, VkExtent2D extent, uint ms);
+	VkPipeline GetVariant(Pipeline* pipe, uint64 key);
 
-	Pipeline* GetPipeline(const char* shader)
+	ComputePipeline* GetCompute(ComputeHandle handle)
 	{
-		return pipelines[shader];
+		return computes[handle.id];
 	}
 };
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include "Query.h"
+
+#define PIPELINE_STATISTICS_FLAGS (VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT | \
+	VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT)
+
+void PipelineStatistics::Init()
+{
+	auto features = GetPhysicalDeviceFeatures();
+	supported = features.pipelineStatisticsQuery;
+	precise = features.occlusionQueryPrecise;
+	inherited = features.inheritedQueries;
+	if (!supported)
+		return;
+
+	VkQueryPoolCreateInfo info = { VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO };
+	info.queryCount = MAX_PIPELINE_QUERIES;
+	for (uint i = 0; i < NFRAMES; ++i)
+	{
+		info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+		info.pipelineStatistics = PIPELINE_STATISTICS_FLAGS;
+		CreateQueryPool(&info, &stats[i]);
+		info.queryType = VK_QUERY_TYPE_OCCLUSION;
+		info.pipelineStatistics = 0;
+		CreateQueryPool(&info, &occlusion[i]);
+	}
+}
+
+void PipelineStatistics::Destroy()
+{
+	if (!supported)
+		return;
+	for (uint i = 0; i < NFRAMES; ++i)
+	{
+		DestroyQueryPool(stats[i]);
+		DestroyQueryPool(occlusion[i]);
+	}
+}
+
+//must be recorded outside the render pass, before the first region of the frame
+void PipelineStatistics::Reset(CommandBuffer& cmd, uint frame)
+{
+	regions[frame].clear();
+	open = false;
+	if (!enabled || !supported)
+		return;
+	cmd.ResetQueryPool(stats[frame], 0, MAX_PIPELINE_QUERIES);
+	cmd.ResetQueryPool(occlusion[frame], 0, MAX_PIPELINE_QUERIES);
+}
+
+void PipelineStatistics::Begin(CommandBuffer& cmd, uint frame, const char* name)
+{
+	End(cmd, frame);
+	if (!enabled || !supported || regions[frame].size() == MAX_PIPELINE_QUERIES)
+		return;
+	uint query = regions[frame].size();
+	regions[frame].push_back(name);
+	cmd.BeginQuery(stats[frame], query, 0);
+	cmd.BeginQuery(occlusion[frame], query, precise ? VK_QUERY_CONTROL_PRECISE_BIT : 0);
+	open = true;
+}
+
+void PipelineStatistics::End(CommandBuffer& cmd, uint frame)
+{
+	if (!open)
+		return;
+	uint query = regions[frame].size() - 1;
+	cmd.EndQuery(stats[frame], query);
+	cmd.EndQuery(occlusion[frame], query);
+	open = false;
+}
+
+void PipelineStatistics::Inherit(VkCommandBufferInheritanceInfo& info)
+{
+	if (!enabled || !supported || !inherited)
+		return;
+	info.occlusionQueryEnable = 1;
+	info.queryFlags = precise ? VK_QUERY_CONTROL_PRECISE_BIT : 0;
+	info.pipelineStatistics = PIPELINE_STATISTICS_FLAGS;
+}
+
+//called for a frame whose fence was just waited on, before Reset records over its queries, so the readout is
+//NFRAMES - 1 frames late but complete, a region whose results are somehow not available is left out,
+//returns whether results were replaced
+bool PipelineStatistics::Collect(uint frame)
+{
+	auto& names = regions[frame];
+	if (names.empty())
+		return false;
+
+	uint64 counters[MAX_PIPELINE_QUERIES][4];
+	uint64 samples[MAX_PIPELINE_QUERIES][2];
+	auto flags = VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT;
+	GetQueryPoolResults(stats[frame], 0, names.size(), sizeof(counters), counters, sizeof(counters[0]), flags);
+	GetQueryPoolResults(occlusion[frame], 0, names.size(), sizeof(samples), samples, sizeof(samples[0]), flags);
+
+	results.clear();
+	for (uint i = 0; i < names.size(); ++i)
+	{
+		if (!counters[i][3] || !samples[i][1])
+			continue;
+		auto it = std::find_if(results.begin(), results.end(), [&](Result& r) { return !strcmp(r.name, names[i]); });
+		if (it == results.end())
+			it = results.insert(results.end(), { names[i] });
+		it->counters.vertices += counters[i][0];
+		it->counters.primitives += counters[i][1];
+		it->counters.fragments += counters[i][2];
+		it->counters.samples += samples[i][0];
+		it->counters.regions++;
+	}
+	names.clear();
+	return true;
+}
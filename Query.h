@@ -0,0 +1,47 @@
+#pragma once
+#include "CommandBuffer.h"
+#include "vector"
+
+using std::vector;
+
+#define MAX_PIPELINE_QUERIES 256
+
+//opt-in per pipeline counters, every BindPipeline opens a region that lasts until the next bind or the end of the pass
+struct PipelineStatistics
+{
+	struct Counters
+	{
+		uint64 vertices;
+		uint64 primitives;
+		uint64 fragments;
+		uint64 samples;
+		uint   regions;
+	};
+
+	struct Result
+	{
+		const char* name;
+		Counters	counters;
+	};
+
+	bool				enabled;
+	bool				supported;
+	// without it an occlusion query only tells zero from non-zero
+	bool				precise;
+	// secondary command buffers may execute inside a region, needed to measure parallel recording
+	bool				inherited;
+	bool				open;
+	VkQueryPool			stats[NFRAMES];
+	VkQueryPool			occlusion[NFRAMES];
+	vector<const char*>	regions[NFRAMES];
+	vector<Result>		results;
+
+	void Init();
+	void Destroy();
+	void Reset(CommandBuffer& cmd, uint frame);
+	void Begin(CommandBuffer& cmd, uint frame, const char* name);
+	void End(CommandBuffer& cmd, uint frame);
+	bool Collect(uint frame);
+	// lets a secondary command buffer run inside a region, a no-op without inherited queries
+	void Inherit(VkCommandBufferInheritanceInfo& info);
+};
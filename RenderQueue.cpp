@@ -0,0 +1,81 @@
+#include "RenderQueue.h"
+#include "Bindable.h"
+
+uint RenderQueue::FindMaterial(BindableSet&& set)
+{
+	auto it = materials.find(set);
+	if (it != materials.end())
+		return it->second;
+	if (materials.size() >= RENDER_QUEUE_OVERFLOW_MATERIAL)
+		return RENDER_QUEUE_OVERFLOW_MATERIAL;
+	return materials.emplace(std::move(set), (uint)materials.size()).first->second;
+}
+
+uint RenderQueue::FindGeometry(const void* mesh, uint submesh, uint lod)
+{
+	uint64 id = meshes.emplace(mesh, (uint)meshes.size()).first->second;
+	uint64 key = id << 40 | uint64(lod) << 32 | submesh;
+	auto it = geometries.find(key);
+	if (it != geometries.end())
+		return it->second;
+	if (geometries.size() >= RENDER_QUEUE_OVERFLOW_GEOMETRY)
+		return RENDER_QUEUE_OVERFLOW_GEOMETRY;
+	return geometries.emplace(key, (uint)geometries.size()).first->second;
+}
+
+//forgets every id once a bindable was freed, whose address a new texture or buffer may take over,
+//or once an id space has filled up, returns whether ids were reset so records holding old ids can be rebuilt
+bool RenderQueue::Recycle()
+{
+	if (epoch == Bindable::freed && materials.size() < RENDER_QUEUE_OVERFLOW_MATERIAL && geometries.size() < RENDER_QUEUE_OVERFLOW_GEOMETRY)
+		return false;
+	epoch = Bindable::freed;
+	materials.clear();
+	meshes.clear();
+	geometries.clear();
+	return true;
+}
+
+//lsd radix sort over the 8 key bytes, a byte every packet agrees on is skipped
+void RenderQueue::Sort()
+{
+	uint n = packets.size();
+	if (n < 2)
+		return;
+	scratch.resize(n);
+	for (uint shift = 0; shift < 64; shift += 8)
+	{
+		uint count[256] = {};
+		for (auto& packet : packets)
+			count[(packet.key >> shift) & 0xff]++;
+		if (count[(packets[0].key >> shift) & 0xff] == n)
+			continue;
+
+		uint offset = 0;
+		for (auto& c : count)
+		{
+			uint size = c;
+			c = offset;
+			offset += size;
+		}
+		for (auto& packet : packets)
+			scratch[count[(packet.key >> shift) & 0xff]++] = packet;
+		packets.swap(scratch);
+	}
+}
+
+//assigns every sorted packet the object slot of its position and collapses runs of the same geometry and state
+//into one instanced draw, so the objects of a batch are contiguous from its first slot
+void RenderQueue::Batch(bool instancing)
+{
+	batches.clear();
+	for (uint i = 0; i < packets.size(); ++i)
+	{
+		auto& packet = packets[i];
+		packet.object = i;
+		if (instancing && batches.size() && batches.back().key >> 16 == packet.key >> 16 && GeometryOf(packet.key) != RENDER_QUEUE_OVERFLOW_GEOMETRY)
+			batches.back().count++;
+		else
+			batches.push_back(packet);
+	}
+}
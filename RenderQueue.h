@@ -0,0 +1,67 @@
+#pragma once
+#include "pch.h"
+#include "Descriptor.h"
+
+#define RENDER_QUEUE_MAX_DEPTH 4096.f
+//handed out once an id space is full, packets carrying one still sort together but are never batched
+#define RENDER_QUEUE_OVERFLOW_MATERIAL 0xffff
+#define RENDER_QUEUE_OVERFLOW_GEOMETRY 0xffffff
+
+//[63:56] pipeline | [55:40] material | [39:16] geometry | [15:0] view depth, front to back
+//packets whose keys agree above the depth bits draw the same submesh with the same state
+inline uint64 MakeSortKey(uint pipeline, uint material, uint geometry, float depth)
+{
+	uint quantized = uint(std::clamp(depth / RENDER_QUEUE_MAX_DEPTH, 0.f, 1.f) * 0xffff);
+	return uint64(pipeline & 0xff) << 56 | uint64(material & 0xffff) << 40 | uint64(geometry & 0xffffff) << 16 | quantized;
+}
+
+struct DrawPacket
+{
+	uint64	key;
+	uint	instance;
+	uint	submesh;
+	uint	object;
+	uint	count;
+};
+
+//draw packets of one frame, sorted by key so consecutive packets share pipeline and material as often as possible
+struct RenderQueue
+{
+	vector<DrawPacket>					packets;
+	vector<DrawPacket>					scratch;
+	// one packet per draw after Batch, object is the first of count consecutive object slots
+	vector<DrawPacket>					batches;
+	// resolved variant per pipeline id, filled before recording so worker threads never touch the pipeline manager
+	vector<VkPipeline>					pipelines;
+	// depth only pipeline every packet is drawn with in the pre-pass
+	VkPipeline							depth;
+	// stable ids for material sets, shared across frames
+	unordered_map<BindableSet, uint>	materials;
+	// stable ids for (mesh, submesh, lod), shared across frames
+	unordered_map<const void*, uint>	meshes;
+	unordered_map<uint64, uint>			geometries;
+	// Bindable::freed when the ids were last reset
+	uint								epoch = 0;
+
+	void Clear()
+	{
+		packets.clear();
+		batches.clear();
+	}
+
+	void Push(uint64 key, uint instance, uint submesh, uint object)
+	{
+		packets.push_back({ key, instance, submesh, object, 1 });
+	}
+
+	uint FindMaterial(BindableSet&& set);
+	uint FindGeometry(const void* mesh, uint submesh, uint lod);
+	bool Recycle();
+
+	void Sort();
+	void Batch(bool instancing);
+
+	static uint PipelineOf(uint64 key) { return key >> 56; }
+	static uint MaterialOf(uint64 key) { return (key >> 40) & 0xffff; }
+	static uint GeometryOf(uint64 key) { return (key >> 16) & 0xffffff; }
+};
@@ -2,6 +2,9 @@
 #include "imgui/imgui.h"
 #include "imgui/imgui_impl_win32.h"
 #include "imgui/imgui_impl_vulkan.h"
+#include "mango/core/thread.hpp"
+#include "atomic"
+#include "cfloat"
 
 VkDescriptorPool imguiPool;
 
@@ -9,6 +12,7 @@ Renderer::Renderer(uint x, uint y, bool fs, uint ms, vector<PipelineCreateInfo>
     win(x, y, fs),
     sc(win.hwnd, win.GetExtent()),
     pass(MkRenderPass(ms)),
+    resumePass(MkRenderPass(ms, true)),
     ms(ms),
     current(-1),
     resource{},
@@ -16,7 +20,10 @@ Renderer::Renderer(uint x, uint y, bool fs, uint ms, vector<PipelineCreateInfo>
     current_scene(Scene::Create(win))
 {
     clear[0] = { 0.3, 0, 0.5, 1 };
-    pipes.CreatePipelines(std::move(createInfos), pass, win.GetExtent(), ms);
+    pipes.LoadCache(PIPELINE_CACHE_PATH);
+    pipes.CreatePipelines(std::move(createInfos), pass, ms);
+    cull = pipes.ResolveCompute("cull");
+    downsample = pipes.ResolveCompute("hiz");
     clear[1].depthStencil.depth = 1;
     clear[1].depthStencil.stencil = 1;
     Init();
@@ -30,16 +37,53 @@ Renderer::Renderer(uint x, uint y, bool fs, uint ms, vector<PipelineCreateInfo>
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     allocInfo.commandBufferCount = NFRAMES;
     AllocateCommandBuffers(&allocInfo, &cmd->handle);
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    allocInfo.commandBufferCount = 1;
     for (uint i = 0; i < NFRAMES; ++i)
+    {
         fence[i] = CreateFence(1);
+        state[i].cmd = cmd[i];
+        AllocateCommandBuffers(&allocInfo, &ui[i].cmd.handle);
+    }
+
+    nrecord = std::min((uint)mango::ThreadPool::getInstance().size(), (uint)MAX_RECORD_THREADS);
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    for (auto& frame : record)
+        for (uint i = 0; i < nrecord; ++i)
+        {
+            frame[i].pool = CreateCommandPool(&poolInfo);
+            allocInfo.commandPool = frame[i].pool;
+            AllocateCommandBuffers(&allocInfo, &frame[i].state.cmd.handle);
+        }
+    for (auto& ctx : depthPass)
+    {
+        ctx.pool = CreateCommandPool(&poolInfo);
+        allocInfo.commandPool = ctx.pool;
+        AllocateCommandBuffers(&allocInfo, &ctx.state.cmd.handle);
+    }
+    stats.Init();
+}
+
+Renderer::~Renderer()
+{
+    DeviceWaitIdle();
+    stats.Destroy();
+    pipes.Destroy();
+    pipes.SaveCache(PIPELINE_CACHE_PATH);
+    DestroyPipelineCache(pipes.cache);
+    pipes.DestroyLayouts();
 }
 
 void Renderer::Init()
 {
     depthBuffer = Image::Create(VK_FORMAT_D32_SFLOAT,
         VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT |
-        VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+        VK_IMAGE_USAGE_SAMPLED_BIT,
         win.GetExtent(), 1, ms, VK_IMAGE_ASPECT_DEPTH_BIT);
+    //also read by hiz.comp, in the layout the render pass leaves it in
+    depthBuffer->type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    depthBuffer->layout() = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    hiz.Create(win.GetExtent());
     colorBuffer = Image::Create(VK_FORMAT_B8G8R8A8_UNORM,
         VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
         VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
@@ -55,11 +99,19 @@ void Renderer::Recreate()
 {
     DeviceWaitIdle();
     sc.Recreate(win.GetExtent());
-    DestroyRenderPass(pass);
-    pass = MkRenderPass(ms);
-    pipes.Recreate(pass, win.GetExtent(), ms);
+    if (pipes.ms != ms)
+    {
+        //a background reload may build against the old pass until Recreate returns
+        VkRenderPass old[2] = { pass, resumePass };
+        pass = MkRenderPass(ms);
+        resumePass = MkRenderPass(ms, true);
+        pipes.Recreate(pass, ms);
+        DestroyRenderPass(old[0]);
+        DestroyRenderPass(old[1]);
+    }
     depthBuffer->Free();
     colorBuffer->Free();
+    hiz.Free();
     Init();
     for (auto cb : callbacks)
         cb.call(this);
@@ -85,51 +137,470 @@ void Renderer::AddCallback(PFN_callback cb, void* ptr)
 
 void Renderer::BeginCommands()
 {
+    if (pushSet != pipes.pushSet)
+    {
+        DeviceWaitIdle();
+        pipes.SetPushSet(pushSet);
+        pushSet = pipes.pushSet;
+    }
     WaitForFences(1, &fence[current], 1, -1);
     ResetFences(1, &fence[current]);
     cmd[current].ResetCommandBuffer(VK_COMMAND_BUFFER_RESET_RELEASE_RESOURCES_BIT);
     VkCommandBufferBeginInfo info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
     info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     cmd[current].BeginCommandBuffer(&info);
+    state[current].enabled = filterState;
+    state[current].Invalidate();
+    for (uint i = 0; i < nrecord; ++i)
+        ResetCommandPool(record[current][i].pool, 0);
+    ResetCommandPool(depthPass[current].pool, 0);
+    //the fence makes this slot's queries complete, read them before Reset records over them
+    if (stats.Collect(current))
+        for (auto& result : stats.results)
+            if (!strcmp(result.name, pipes.GetPipeline(BuiltinPipeline("shader1"))->shader))
+                shaded[prepassed[current]] = result.counters.fragments;
+    stats.Reset(cmd[current], current);
 }
 
-void Renderer::BeginFrame()
+// pass = false leaves the frame outside the render pass so compute work can be recorded first,
+// BeginRenderPass must then be called before drawing
+void Renderer::BeginFrame(bool pass)
 {
+    pipes.Update();
     DrawImguiWindows();
     AcquireNextImage();
     BeginCommands();
-    cmd[current].BeginRenderPass(&resource[current].passInfo, VK_SUBPASS_CONTENTS_INLINE);
+    if (pass)
+        BeginRenderPass();
+}
+
+// with parallel recording everything inside the pass, imgui included, goes through secondary command buffers,
+// resume picks the frame up again after compute work was recorded between passes
+void Renderer::BeginRenderPass(bool resume)
+{
+    bool secondary = parallel && nrecord > 1 && !current_scene->gpuDriven;
+    contents = secondary ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE;
+    VkRenderPassBeginInfo info = resource[current].passInfo;
+    if (resume)
+        info.renderPass = resumePass;
+    cmd[current].BeginRenderPass(&info, contents);
+    if (contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS)
+        return;
+    auto extent = win.GetExtent();
+    SetViewport(0, 0, extent.width, extent.height);
+    SetScissor(0, 0, extent.width, extent.height);
+}
+
+void Renderer::BeginSecondary(StateCache& state)
+{
+    VkCommandBufferInheritanceInfo inheritance = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO };
+    inheritance.renderPass = pass;
+    inheritance.subpass = 0;
+    inheritance.framebuffer = resource[current].framebuffer;
+    stats.Inherit(inheritance);
+    VkCommandBufferBeginInfo info = { VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO };
+    info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    info.pInheritanceInfo = &inheritance;
+    state.cmd.BeginCommandBuffer(&info);
+    state.enabled = filterState;
+    state.Invalidate();
+
+    //dynamic state is not inherited from the primary
+    auto extent = win.GetExtent();
+    state.SetViewport({ 0, 0, (float)extent.width, (float)extent.height, 0.f, 1.f });
+    state.SetScissor({ { 0, 0 }, extent });
 }
 
 void Renderer::EndFrame()
 {
-    ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd[current]);
+    stats.End(cmd[current], current);
+    if (contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS)
+    {
+        BeginSecondary(ui[current]);
+        ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), ui[current].cmd);
+        ui[current].cmd.EndCommandBuffer();
+        cmd[current].ExecuteCommands(1, &ui[current].cmd.handle);
+    }
+    else
+        ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), cmd[current]);
     cmd[current].EndRenderPass();
     cmd[current].EndCommandBuffer();
+
+    //shown one frame late, like the pipeline statistics
+    issued = state[current].issued;
+    elided = state[current].elided;
+    state[current].issued = state[current].elided = 0;
+    for (uint i = 0; i <= nrecord; ++i)
+    {
+        auto& secondary = i < nrecord ? record[current][i].state : depthPass[current].state;
+        issued += secondary.issued;
+        elided += secondary.elided;
+        secondary.issued = secondary.elided = 0;
+    }
     QueueSubmit(1, &resource[current].submitInfo, fence[current]);
     QueuePresent(&resource[current].presentInfo);
 }
 
-void Renderer::BindPipeline(const char* pipeline)
+//everything that has to happen outside the render pass: camera and light upload, then culling on the cpu
+//or, on the gpu driven path, the cull.comp dispatch that fills this frame's indirect commands
+void Renderer::PrepareScene()
+{
+    auto scene = current_scene;
+    //ids from before a bindable was freed may alias new ones, the gpu records are rebuilt with the fresh ids
+    if (scene->queue.Recycle())
+        scene->dirty = true;
+    scene->UpdateBuffer();
+    auto extent = win.GetExtent();
+    scene->BuildLightGrid(current, extent.width, extent.height);
+    scene->UploadPalettes(current);
+    if (!scene->gpuDriven || !cull)
+        return scene->Cull();
+
+    if (scene->dirty || scene->ninstance != scene->mesh.size())
+        scene->BuildDraws();
+    scene->UploadInstances(current);
+
+    cmd[current].FillBuffer(scene->counts->handle(), current * 2 * MAX_DRAW_GROUPS * sizeof(uint), 2 * MAX_DRAW_GROUPS * sizeof(uint), 0);
+    if (scene->resetVisibility)
+    {
+        //nothing counts as drawn, the first phase 2 tests every record against an empty pyramid
+        cmd[current].FillBuffer(scene->visibility->handle(), 0, MAX_OBJECTS * sizeof(uint), 0);
+        scene->resetVisibility = false;
+    }
+    //also orders last frame's visibility writes and pyramid reads before this frame's cull and downsample
+    VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    cmd[current].PipelineBarrier(VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, 0, 0, 0);
+    CullPhase(Occlusion() ? 1 : 0);
+}
+
+//phase 0 and 1 fill the first command region of the frame, phase 2 the second
+void Renderer::CullPhase(uint phase)
 {
-    cmd[current].BindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, pipes.GetPipeline(pipeline)->handle);
+    auto scene = current_scene;
+    uint region = current * 2 + (phase == 2);
+    CullConstants constants;
+    Frustum frustum(scene->vp);
+    std::copy(frustum.planes, frustum.planes + 6, constants.planes);
+    constants.vp = scene->vp;
+    constants.pyramid[0] = (float)hiz.extent.width;
+    constants.pyramid[1] = (float)hiz.extent.height;
+    constants.levels = hiz.nlevels;
+    constants.phase = phase;
+    constants.ndraw = scene->ndraw;
+    constants.objectBase = current * MAX_OBJECTS;
+    constants.commandBase = region * MAX_OBJECTS;
+    constants.countBase = region * MAX_DRAW_GROUPS;
+    constants.lodScale = scene->LodScale();
+    constants.lodLevels = scene->lod ? MAX_LODS : 1;
+    BindCompute(cull);
+    BindSet(0, scene->cbuffer, scene->objects, scene->lightData[current], scene->clusters[current]);
+    BindSet(3, scene->instances, scene->draws, scene->commands, scene->counts, scene->visibility, &hiz.all);
+    PushConstants(constants);
+    Dispatch((scene->ndraw + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+    ComputeBarrier();
+}
+
+//must be recorded outside the render pass, whose outgoing dependency makes the depth writes visible to compute
+void Renderer::BuildPyramid()
+{
+    BindCompute(downsample);
+    for (uint i = 0; i < hiz.nlevels; ++i)
+    {
+        BindSet(4, depthBuffer, &hiz.levels[i ? i - 1 : 0], &hiz.levels[i]);
+        PushConstants(HiZConstants{ i, ms });
+        auto size = hiz.LevelExtent(i);
+        Dispatch((size.width + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, (size.height + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+        ComputeBarrier();
+    }
+}
+
+void Renderer::RenderScene()
+{
+    auto begin = std::chrono::high_resolution_clock::now();
+    auto scene = current_scene;
+    prepassed[current] = prepass && pipes.GetPipeline(BuiltinPipeline("depth"));
+    if (scene->gpuDriven && cull)
+        RenderGpuDriven();
+    else
+    {
+        BuildQueue();
+        if (contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS)
+            RecordParallel();
+        else
+        {
+            uint nbatch = scene->queue.batches.size();
+            bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+            BindSet(0, scene->cbuffer, scene->objects, scene->lightData[current], scene->clusters[current]);
+            if (prepassed[current])
+                RecordBatches(state[current], 0, nbatch, true);
+            RecordBatches(state[current], 0, nbatch);
+        }
+    }
+    record_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+    auto& avg = record_avg[pipes.pushSet >= 0];
+    avg = avg ? avg * 0.95 + record_ms * 0.05 : record_ms;
+}
+
+//one indirect draw per group, the cpu cost depends on the number of distinct mesh and material pairs, not on instances
+//draws what phase 1 let through, then with occlusion culling ends the pass to build the pyramid from that depth,
+//runs phase 2 and resumes the pass for whatever became visible
+void Renderer::RenderGpuDriven()
+{
+    auto scene = current_scene;
+    uint stride = sizeof(VkDrawIndexedIndirectCommand);
+    auto draw = [&](uint region, bool depthOnly)
+    {
+        BindSet(0, scene->cbuffer, scene->objects, scene->lightData[current], scene->clusters[current]);
+        for (uint i = 0; i < scene->groups.size(); ++i)
+        {
+            auto& group = scene->groups[i];
+            BindVertexBuffer(group.mesh->buffer);
+            BindVertexBuffer(group.mesh->buffer, group.mesh->aoffset, 1);
+            BindIndexBuffer(group.mesh->buffer, group.mesh->ioffset);
+            if (!depthOnly)
+                BindSet(2, group.textures[0], group.textures[1], group.textures[2]);
+            DrawIndexedIndirectCount(scene->commands, uint64(region * MAX_OBJECTS + group.base) * stride,
+                scene->counts, uint64(region * MAX_DRAW_GROUPS + i) * sizeof(uint), group.size);
+        }
+    };
+    auto phase = [&](uint region)
+    {
+        uint64 variant = scene->Variant();
+        if (prepassed[current])
+        {
+            BindPipeline(BuiltinPipeline("depth"));
+            draw(region, true);
+            variant |= VARIANT_DEPTH_EQUAL;
+        }
+        BindPipeline(BuiltinPipeline("shader1"), variant);
+        draw(region, false);
+    };
+
+    phase(current * 2);
+    if (!Occlusion())
+        return;
+
+    stats.End(cmd[current], current);
+    cmd[current].EndRenderPass();
+    BuildPyramid();
+    CullPhase(2);
+    BeginRenderPass(true);
+    phase(current * 2 + 1);
+}
+
+//one packet per visible submesh keyed on pipeline, material and view depth, object records are written here
+//in packet creation order so recording only reads them, every submesh also picks its level from its projected size
+void Renderer::BuildQueue()
+{
+    auto scene = current_scene;
+    auto& queue = scene->queue;
+    auto shader1 = BuiltinPipeline("shader1");
+    queue.Clear();
+    queue.pipelines.resize(pipes.pipelines.size());
+    queue.pipelines[shader1.id] = pipes.GetVariant(pipes.GetPipeline(shader1), scene->Variant() | (prepassed[current] ? VARIANT_DEPTH_EQUAL : 0));
+    if (prepassed[current])
+        queue.depth = pipes.GetPipeline(BuiltinPipeline("depth"))->handle;
+
+    auto& xforms = scene->xforms;
+    xforms.resize(scene->mesh.size());
+    float lodScale = scene->LodScale();
+    std::fill_n(scene->nlods, MAX_LODS, 0);
+    for (uint i = 0; i < scene->mesh.size(); ++i)
+    {
+        auto& m = scene->mesh[i];
+        mat xf = xforms[i] = m.xform.Get();
+        mat wvp = xf * scene->vp;
+        float scale = std::max(len(zerow(xf.x)).x, std::max(len(zerow(xf.y)).x, len(zerow(xf.z)).x));
+        for (uint j = 0; j < m.submesh.size() && queue.packets.size() < MAX_OBJECTS; ++j)
+        {
+            auto& sm = m.submesh[j];
+            if (!sm.visible)
+                continue;
+            //clip w of the box center is its view depth
+            vec4 center = (sm.lo + sm.hi) * vec4(0.5f, 0.5f, 0.5f, 0) + vec4(0, 0, 0, 1);
+            float depth = (center * wvp).w;
+            //the camera inside the bounding sphere always gets full detail
+            float radius = len(zerow(sm.hi - sm.lo)).x * 0.5f * scale;
+            float size = depth > radius ? radius * lodScale / depth : FLT_MAX;
+            sm.lod = SelectLod(size, sm.lod, scene->lod ? sm.nlod : 1);
+            scene->nlods[sm.lod]++;
+            uint material = queue.FindMaterial({ sm.mat.textures[0], sm.mat.textures[1], sm.mat.textures[2] });
+            uint geometry = scene->instancing ? queue.FindGeometry(m.mesh, j, sm.lod) : 0;
+            queue.Push(MakeSortKey(shader1.id, material, geometry, depth), i, j, 0);
+        }
+    }
+    queue.Sort();
+    queue.Batch(scene->instancing);
+
+    //objects are written in sorted order so every batch reads its transforms from consecutive slots,
+    //the fence wait in BeginCommands makes this frame's slice safe to overwrite
+    auto objects = scene->objects->Get<Scene::ObjectData>() + current * MAX_OBJECTS;
+    for (auto& packet : queue.packets)
+    {
+        auto& object = objects[packet.object];
+        object.xf = xforms[packet.instance];
+        object.prev = scene->mesh[packet.instance].prev;
+        object.material = RenderQueue::MaterialOf(packet.key);
+        object.bones = scene->bones[packet.instance];
+    }
+    for (uint i = 0; i < scene->mesh.size(); ++i)
+        scene->mesh[i].prev = xforms[i];
+}
+
+//records batches [begin, end) of the sorted queue, rebinding pipeline, buffers and material only when they change,
+//depthOnly draws the same batches with the pre-pass pipeline and no materials
+void Renderer::RecordBatches(StateCache& state, uint begin, uint end, bool depthOnly)
+{
+    auto scene = current_scene;
+    auto& queue = scene->queue;
+    uint pipeline = -1;
+    Texture* textures[3] = {};
+    Mesh* mesh = 0;
+    for (uint i = begin; i < end; ++i)
+    {
+        auto& packet = queue.batches[i];
+        auto& m = scene->mesh[packet.instance];
+        auto& sm = m.submesh[packet.submesh];
+        if (RenderQueue::PipelineOf(packet.key) != pipeline)
+        {
+            pipeline = RenderQueue::PipelineOf(packet.key);
+            if (contents == VK_SUBPASS_CONTENTS_INLINE)
+                stats.Begin(state.cmd, current, pipes.pipelines[depthOnly ? BuiltinPipeline("depth").id : pipeline]->shader);
+            state.BindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, depthOnly ? queue.depth : queue.pipelines[pipeline]);
+        }
+        if (m.mesh != mesh)
+        {
+            mesh = m.mesh;
+            VkDeviceSize offsets[2] = { 0, mesh->aoffset };
+            VkBuffer buffers[2] = { mesh->buffer->handle(), mesh->buffer->handle() };
+            state.BindVertexBuffers(0, 2, buffers, offsets);
+            state.BindIndexBuffer(mesh->buffer->handle(), mesh->ioffset);
+        }
+        //the textures themselves are compared, material ids only order the queue
+        if (!depthOnly && !std::equal(textures, textures + 3, sm.mat.textures))
+        {
+            std::copy(sm.mat.textures, sm.mat.textures + 3, textures);
+            BindSet(state, 2, sm.mat.textures[0], sm.mat.textures[1], sm.mat.textures[2]);
+        }
+        //batched packets share the geometry id and with it the level
+        auto& lod = sm.lods[sm.lod];
+        state.cmd.DrawIndexed(lod.nidx, packet.count, lod.ioffset, sm.voffset, current * MAX_OBJECTS + packet.object);
+    }
+}
+
+//splits the sorted queue into nrecord contiguous ranges, each recorded into its own secondary command buffer
+//on the thread pool, so every chunk keeps the state coherence of the sort
+void Renderer::RecordParallel()
+{
+    auto scene = current_scene;
+    uint nbatch = scene->queue.batches.size();
+    uint chunk = (nbatch + nrecord - 1) / nrecord;
+
+    bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    VkCommandBuffer secondary[MAX_RECORD_THREADS];
+    uint nsecondary = 0;
+    {
+        mango::ConcurrentQueue queue;
+        if (prepassed[current])
+            queue.enqueue([this, scene, nbatch]
+            {
+                auto& ctx = depthPass[current].state;
+                BeginSecondary(ctx);
+                BindSet(ctx, 0, scene->cbuffer, scene->objects, scene->lightData[current], scene->clusters[current]);
+                RecordBatches(ctx, 0, nbatch, true);
+                ctx.cmd.EndCommandBuffer();
+            });
+        for (uint begin = 0; begin < nbatch; begin += chunk)
+        {
+            auto& ctx = record[current][nsecondary];
+            secondary[nsecondary++] = ctx.state.cmd;
+            queue.enqueue([this, &ctx, scene, nbatch, begin, end = std::min(begin + chunk, nbatch)]
+            {
+                BeginSecondary(ctx.state);
+                BindSet(ctx.state, 0, scene->cbuffer, scene->objects, scene->lightData[current], scene->clusters[current]);
+                RecordBatches(ctx.state, begin, end);
+                ctx.state.cmd.EndCommandBuffer();
+            });
+        }
+        queue.wait();
+    }
+    //secondaries cannot open regions of their own, so with inherited queries the primary opens one per execute,
+    //the shading region carries every pipeline in the chunks under the name of the first
+    bool measure = stats.inherited;
+    if (prepassed[current])
+    {
+        if (measure)
+            stats.Begin(cmd[current], current, pipes.GetPipeline(BuiltinPipeline("depth"))->shader);
+        cmd[current].ExecuteCommands(1, &depthPass[current].state.cmd.handle);
+    }
+    if (nsecondary)
+    {
+        if (measure)
+            stats.Begin(cmd[current], current, pipes.pipelines[RenderQueue::PipelineOf(scene->queue.batches[0].key)]->shader);
+        cmd[current].ExecuteCommands(nsecondary, secondary);
+    }
+    stats.End(cmd[current], current);
+    state[current].Invalidate();
+}
+
+void Renderer::BindPipeline(PipelineHandle pipeline, uint64 variant)
+{
+    auto pipe = pipes.GetPipeline(pipeline);
+    bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    stats.Begin(cmd[current], current, pipe->shader);
+    state[current].BindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, pipes.GetVariant(pipe, variant));
+}
+
+void Renderer::BindCompute(ComputeHandle pipeline)
+{
+    bindPoint = VK_PIPELINE_BIND_POINT_COMPUTE;
+    stats.End(cmd[current], current);
+    state[current].BindPipeline(VK_PIPELINE_BIND_POINT_COMPUTE, pipes.GetCompute(pipeline)->handle);
+}
+
+void Renderer::Dispatch(uint x, uint y, uint z)
+{
+    cmd[current].Dispatch(x, y, z);
+}
+
+void Renderer::DispatchIndirect(Buffer* buffer, uint64 offset)
+{
+    cmd[current].DispatchIndirect(buffer->handle(), offset);
+}
+
+void Renderer::ComputeBarrier()
+{
+    // compute results become visible to indirect draws, vertex fetch and every later shader stage
+    VkMemoryBarrier barrier = { VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+        VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    cmd[current].PipelineBarrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+        VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &barrier, 0, 0, 0, 0);
 }
 
 void Renderer::SetViewport(float x, float y, float w, float h)
 {
-    VkViewport vp = { x, y, w, h, 0.f, 1.f };
-    cmd[current].SetViewport(0, 1, &vp);
+    state[current].SetViewport({ x, y, w, h, 0.f, 1.f });
+}
+
+void Renderer::SetScissor(int x, int y, uint w, uint h)
+{
+    state[current].SetScissor({ { x, y }, { w, h } });
 }
 
-void Renderer::BindVertexBuffer(Buffer* buffer)
+void Renderer::BindVertexBuffer(Buffer* buffer, uint64 offset, uint stream)
 {
-    uint64 offsets[1] = { 0 };
-    cmd[current].BindVertexBuffers(0, 1, &buffer->handle(), offsets);
+    state[current].BindVertexBuffers(stream, 1, &buffer->handle(), &offset);
 }
 
 void Renderer::BindIndexBuffer(Buffer* buffer, uint64 offset)
 {
-    cmd[current].BindIndexBuffer(buffer->handle(), offset, VK_INDEX_TYPE_UINT32);
+    state[current].BindIndexBuffer(buffer->handle(), offset);
 }
 
 void Renderer::Draw(uint nvertex, uint ninstance, uint first_vertex, uint first_inst)
@@ -142,6 +613,11 @@ void Renderer::DrawIndexed(uint nidx, uint ninstance, uint first_idx, uint voffs
     cmd[current].DrawIndexed(nidx, ninstance, first_idx, voffset, first_instance);
 }
 
+void Renderer::DrawIndexedIndirectCount(Buffer* buffer, uint64 offset, Buffer* count, uint64 countOffset, uint maxDraws)
+{
+    cmd[current].DrawIndexedIndirectCount(buffer->handle(), offset, count->handle(), countOffset, maxDraws, sizeof(VkDrawIndexedIndirectCommand));
+}
+
 void InitImguiVulkan(VkRenderPass pass, uint ms)
 {
     ImGui_ImplVulkan_InitInfo init_info = {};
@@ -197,19 +673,259 @@ void Renderer::DrawImguiWindows()
     ImGui_ImplWin32_NewFrame();
     NewFrame();
     current_scene->DrawHierarchy();
+    Begin("Renderer");
+    Text("Scene recording: %.3f ms", record_ms);
+    Checkbox("Frustum culling", (bool*)&current_scene->culling);
+    Checkbox("Filter redundant state", (bool*)&filterState);
+    if (pipes.GetPipeline(BuiltinPipeline("depth")))
+        Checkbox("Depth pre-pass", (bool*)&prepass);
+    if (stats.enabled && shaded[0] && shaded[1])
+        Text("Shaded fragments: %llu without pre-pass, %llu with (%.1f%% saved)",
+            shaded[0], shaded[1], 100.0 * (1.0 - double(shaded[1]) / shaded[0]));
+    else if (stats.enabled && contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS && !stats.inherited)
+        Text("Shaded fragments: no inherited queries, turn parallel recording off to measure");
+    else if (stats.enabled)
+        Text("Shaded fragments: toggle the pre-pass to compare");
+    Text("State calls issued: %u elided: %u", issued, elided);
+    if (cull)
+        Checkbox("GPU driven", (bool*)&current_scene->gpuDriven);
+    if (current_scene->gpuDriven && cull && downsample && ms > 1)
+        Checkbox("Occlusion culling", (bool*)&current_scene->occlusion);
+    if (current_scene->gpuDriven && cull)
+        Text("Draw records: %u groups: %u", current_scene->ndraw, (uint)current_scene->groups.size());
+    else
+    {
+        Checkbox("Automatic instancing", (bool*)&current_scene->instancing);
+        Text("Submeshes visible: %u culled: %u", current_scene->nvisible, current_scene->nculled);
+        Text("Draws: %u packets: %u", (uint)current_scene->queue.batches.size(), (uint)current_scene->queue.packets.size());
+        auto& nlods = current_scene->nlods;
+        Text("Submeshes per LOD: %u %u %u %u", nlods[0], nlods[1], nlods[2], nlods[3]);
+    }
+    Checkbox("Mesh LOD", (bool*)&current_scene->lod);
+    if (current_scene->lod)
+        SliderFloat("LOD bias", &current_scene->lodBias, 0.25f, 4.f);
+    Text(pipes.pushSet < 0 ? "Descriptors: pooled sets" : "Descriptors: push set %d", pipes.pushSet);
+    SliderInt("Push descriptor set", &pushSet, -1, (int)pipes.descLayouts.size() - 1);
+    Text("Average scene recording: pooled %.3f ms, push %.3f ms", record_avg[0], record_avg[1]);
+    if (nrecord > 1)
+        Checkbox("Parallel recording", (bool*)&parallel);
+    if (contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS)
+        Text("Recording threads: %u", nrecord);
+    if (stats.supported && Checkbox("Pipeline statistics", &stats.enabled) && !stats.enabled)
+        stats.results.clear();
+    if (stats.enabled)
+    {
+        // fragment invocations over covered pixels is the overdraw, over passed samples the share killed by depth
+        auto extent = win.GetExtent();
+        double pixels = double(extent.width) * extent.height;
+        Columns(6);
+        Text("Pipeline"); NextColumn();
+        Text("Vertices"); NextColumn();
+        Text("Primitives"); NextColumn();
+        Text("Fragments"); NextColumn();
+        Text("Overdraw"); NextColumn();
+        Text("Passed"); NextColumn();
+        Separator();
+        for (auto& result : stats.results)
+        {
+            auto& c = result.counters;
+            Text("%s (%u)", result.name, c.regions); NextColumn();
+            Text("%llu", c.vertices); NextColumn();
+            Text("%llu", c.primitives); NextColumn();
+            Text("%llu", c.fragments); NextColumn();
+            Text("%.2fx", c.fragments / pixels); NextColumn();
+            Text("%.1f%%", c.fragments ? 100.0 * c.samples / (c.fragments * ms) : 0.0); NextColumn();
+        }
+        Columns(1);
+    }
+    End();
     Render();
 }
 
+//each instance's world box goes first followed by its submeshes, all tested 8 at a time,
+//large scenes are split over the thread pool with one box list per task
+void Scene::Cull()
+{
+    if (!culling)
+    {
+        uint total = 0;
+        for (auto& m : mesh)
+            for (auto& sm : m.submesh)
+                sm.visible = true, total++;
+        nvisible = total;
+        nculled = 0;
+        return;
+    }
+
+    Frustum frustum(vp);
+    std::atomic<uint> visible = 0;
+    std::atomic<uint> culled = 0;
+    auto task = [&](uint begin, uint end)
+    {
+        BoxList boxes = {};
+        vector<uint8_t> result;
+        uint v = 0, c = 0;
+        for (uint i = begin; i < end; ++i)
+        {
+            auto& m = mesh[i];
+            mat xf = m.xform.Get();
+            boxes.Clear();
+            boxes.Push(m.mesh->lo, m.mesh->hi, xf);
+            for (auto& sm : m.submesh)
+                boxes.Push(sm.lo, sm.hi, xf);
+            result.resize(boxes.count);
+            CullBoxes(frustum, boxes, result.data());
+            for (uint j = 0; j < m.submesh.size(); ++j)
+            {
+                m.submesh[j].visible = result[0] && result[j + 1];
+                m.submesh[j].visible ? v++ : c++;
+            }
+        }
+        visible += v;
+        culled += c;
+    };
+
+    uint n = mesh.size();
+    uint nthread = mango::ThreadPool::getInstance().size();
+    if (n < CULL_PARALLEL_INSTANCES || nthread < 2)
+        task(0, n);
+    else
+    {
+        mango::ConcurrentQueue queue;
+        uint chunk = (n + nthread - 1) / nthread;
+        for (uint begin = 0; begin < n; begin += chunk)
+            queue.enqueue([&task, begin, end = std::min(begin + chunk, n)] { task(begin, end); });
+        queue.wait();
+    }
+    nvisible = visible;
+    nculled = culled;
+}
+
+//lights are written to this frame's slice with their range, then binned into the froxel grid shader1.frag reads
+void Scene::BuildLightGrid(uint frame, uint width, uint height)
+{
+    auto data = lightData[frame]->Get<PointLight>();
+    for (uint i = 0; i < lights.size(); ++i)
+    {
+        auto& light = lights[i];
+        float peak = std::max(light.color.x, std::max(light.color.y, light.color.z));
+        data[i].pos = light.pos;
+        data[i].pos.w = sqrtf(peak / LIGHT_CUTOFF);
+        data[i].color = light.color;
+    }
+
+    auto camera = active_camera;
+    grid.Build(camera->world_to_view(), camera->prj.x.x, camera->prj.y.y, camera->znear, camera->zfar,
+        data, lights.size(), clusters[frame]->Get<ClusterData>());
+
+    vec4 forward = camera->view.z;
+    cbuffer->Get<vec4>()[UBO_CLUSTER_PARAMS] = forward & zero_mask<1, 1, 1, 0>();
+    cbuffer->Get<vec4>()[UBO_CLUSTER_PARAMS + 1] = vec4(float(CLUSTER_X) / width, float(CLUSTER_Y) / height, grid.scale, grid.bias);
+}
+
+//static (instance, submesh) records grouped by mesh and material, rebuilt only when the scene changes
+void Scene::BuildDraws()
+{
+    //in flight frames still read the old records
+    DeviceWaitIdle();
+    groups.clear();
+    vector<GpuDraw> list;
+    for (uint i = 0; i < mesh.size() && i < MAX_OBJECTS; ++i)
+    {
+        auto& m = mesh[i];
+        for (auto& sm : m.submesh)
+        {
+            if (list.size() == MAX_OBJECTS)
+                break;
+            auto group = std::find_if(groups.begin(), groups.end(), [&](GpuDrawGroup& g) {
+                return g.mesh == m.mesh && std::equal(g.textures, g.textures + 3, sm.mat.textures); });
+            if (group == groups.end())
+            {
+                if (groups.size() == MAX_DRAW_GROUPS)
+                    break;
+                group = groups.insert(groups.end(), { m.mesh, { sm.mat.textures[0], sm.mat.textures[1], sm.mat.textures[2] } });
+            }
+            //same ids as the cpu queue, so both paths write the same material into the object records
+            uint material = queue.FindMaterial({ sm.mat.textures[0], sm.mat.textures[1], sm.mat.textures[2] });
+            GpuDraw draw = { sm.lo, sm.hi, {}, (int)sm.voffset, i, material, uint(group - groups.begin()), 0, sm.nlod };
+            for (uint k = 0; k < sm.nlod; ++k)
+                draw.lods[k][0] = sm.lods[k].nidx, draw.lods[k][1] = sm.lods[k].ioffset;
+            group->size++;
+            list.push_back(draw);
+        }
+    }
+
+    uint base = 0;
+    for (auto& group : groups)
+    {
+        group.base = base;
+        base += group.size;
+    }
+    for (auto& draw : list)
+        draw.base = groups[draw.group].base;
+
+    memcpy(draws->ptr, list.data(), list.size() * sizeof(GpuDraw));
+    ndraw = list.size();
+    resetVisibility = true;
+    ninstance = mesh.size();
+    dirty = false;
+}
+
+//copies the palette of every animated instance into this frame's slice, instances sharing a mesh share its palette,
+//the fence wait in BeginCommands makes the slice safe to overwrite
+void Scene::UploadPalettes(uint frame)
+{
+    auto data = palettes->Get<mat>() + frame * MAX_PALETTE_BONES;
+    unordered_map<Mesh*, uint> offsets;
+    uint used = 0;
+    bones.assign(mesh.size(), NO_BONES);
+    for (uint i = 0; i < mesh.size(); ++i)
+    {
+        Mesh* m = mesh[i].mesh;
+        if (!m->anim)
+            continue;
+        auto [it, fresh] = offsets.emplace(m, used);
+        if (fresh)
+        {
+            //the animation uniform holds 64 matrices
+            uint n = std::min(m->animation.nBones, 64u);
+            if (used + n > MAX_PALETTE_BONES)
+            {
+                offsets.erase(it);
+                continue;
+            }
+            memcpy(data + used, m->anim->Get<mat>(), n * sizeof(mat));
+            used += n;
+        }
+        bones[i] = it->second;
+    }
+}
+
+void Scene::UploadInstances(uint frame)
+{
+    auto data = instances->Get<InstanceData>() + frame * MAX_OBJECTS;
+    for (uint i = 0; i < mesh.size() && i < MAX_OBJECTS; ++i)
+    {
+        mat xf = mesh[i].xform.Get();
+        data[i] = { xf, mesh[i].prev, bones[i] };
+        mesh[i].prev = xf;
+    }
+}
+
 void Scene::DrawHierarchy()
 {
     using namespace ImGui;
     Begin("Scene");
     if (Checkbox("Use Flat Normals", (bool*)&use_flat_normals));
     SliderInt("Roughness", &roughness, 0, 255);
+    int nlights = lights.size();
+    if (SliderInt("Lights", &nlights, 0, MAX_LIGHTS))
+        SetLightCount(nlights);
+    Text("Light indices: %u overflow: %u", grid.nindices, grid.noverflow);
     if (Button("Load Model"))
     {
         if(auto m = Mesh::Create(OpenFile().data()))
-            mesh.emplace_back(m);
+            mesh.emplace_back(m), dirty = true;
     }
 
     if (TreeNode("Models"))
@@ -234,9 +950,9 @@ void Scene::DrawHierarchy()
                     PushID(j++);
                     Text(sm.name.data());
                     if (Button("Set Albedo"))
-                        sm.mat.SetTexture(Texture::Create(OpenFile().data(), VK_FORMAT_R8G8B8A8_SRGB), PBR_ALBEDO);
+                        sm.mat.SetTexture(Texture::Create(OpenFile().data(), VK_FORMAT_R8G8B8A8_SRGB), PBR_ALBEDO), dirty = true;
                     if (Button("Set Normal"))
-                        sm.mat.SetTexture(Texture::Create(OpenFile().data(), VK_FORMAT_R8G8B8A8_UNORM), PBR_NORMAL);
+                        sm.mat.SetTexture(Texture::Create(OpenFile().data(), VK_FORMAT_R8G8B8A8_UNORM), PBR_NORMAL), dirty = true;
                     PopID();
                 }
                 TreePop();
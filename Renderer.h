@@ -5,6 +5,63 @@
 #include "Pipeline.h"
 #include "Camera.h"
 #include "Model.h"
+#include "Query.h"
+#include "Culling.h"
+#include "RenderQueue.h"
+#include "LightGrid.h"
+#include "HiZ.h"
+#include "chrono"
+
+#define MAX_OBJECTS 4096
+#define MAX_RECORD_THREADS 16
+#define CULL_PARALLEL_INSTANCES 64
+#define MAX_DRAW_GROUPS 1024
+#define MAX_PALETTE_BONES 16384
+#define NO_BONES 0xffffffff
+#define CULL_GROUP_SIZE 64
+// lights mirrored into the camera uniform for shaders without clustered lighting
+#define UBO_LIGHTS 512
+#define UBO_CLUSTER_PARAMS (6 + 2 * UBO_LIGHTS)
+
+// one record per (instance, submesh) of the gpu driven path, std430 layout of Draw in cull.comp
+struct GpuDraw
+{
+    vec4 lo, hi;
+    uint lods[MAX_LODS][2]; // index count and first index of every level
+    int  voffset;
+    uint instance;
+    uint material;
+    uint group;
+    uint base;
+    uint nlod;
+    uint pad[2];
+};
+
+// draws sharing vertex buffers and material, drawn with a single DrawIndexedIndirectCount over [base, base + size)
+struct GpuDrawGroup
+{
+    Mesh*       mesh;
+    Texture*    textures[3];
+    uint        base;
+    uint        size;
+};
+
+// push constants of cull.comp, phase 0 frustum only, 1 and 2 the two halves of occlusion culling,
+// lodScale is Scene::LodScale and lodLevels caps the levels of every record
+struct CullConstants
+{
+    vec4 planes[6];
+    mat  vp;
+    float pyramid[2];
+    uint levels;
+    uint phase;
+    uint ndraw;
+    uint objectBase;
+    uint commandBase;
+    uint countBase;
+    float lodScale;
+    uint lodLevels;
+};
 
 struct Scene
 {
@@ -14,6 +71,30 @@ struct Scene
         vec4 color;
     };
 
+    // instance transforms read by cull.comp, one slice of MAX_OBJECTS per frame in flight,
+    // mat is 32 byte aligned so the record is padded to 160 bytes on both sides
+    struct InstanceData
+    {
+        mat  xf;
+        mat  prev;
+        uint bones;
+        uint pad[7];
+    };
+    static_assert(sizeof(InstanceData) == 160, "std430 stride of Instance in cull.comp");
+
+    // per-draw data, std430 layout of Object in shader1.vert, depth.vert and cull.comp, indexed by gl_InstanceIndex,
+    // material is the id RenderQueue::FindMaterial gave the submesh's texture set,
+    // bones the first matrix of the instance's palette in this frame's slice of palettes or NO_BONES
+    struct ObjectData
+    {
+        mat  xf;
+        mat  prev;
+        uint material;
+        uint bones;
+        uint pad[6];
+    };
+    static_assert(sizeof(ObjectData) == 160, "std430 stride of Object in the shaders");
+
     struct LightWrapper : Light
     {
         float radius = 1;
@@ -22,13 +103,44 @@ struct Scene
     };
 
     Buffer*                 cbuffer;
+    Buffer*                 objects;
+    Buffer*                 instances;
+    // bone palettes of animated instances, one slice of MAX_PALETTE_BONES per frame in flight
+    Buffer*                 palettes;
+    Buffer*                 draws;
+    Buffer*                 commands;
+    Buffer*                 counts;
+    // per draw record, whether it passed the occlusion test last frame
+    Buffer*                 visibility;
+    Buffer*                 lightData[NFRAMES];
+    Buffer*                 clusters[NFRAMES];
+    LightGrid               grid;
+    vector<GpuDrawGroup>    groups;
+    RenderQueue             queue;
+    uint                    ndraw = 0;
+    uint                    ninstance = 0;
+    bool                    dirty = true;
+    int                     gpuDriven = 0;
+    int                     occlusion = 1;
+    bool                    resetVisibility = true;
     Camera*                 active_camera;
     vector<Camera*>			cameras;
     vector<MeshInstance>	mesh;
+    vector<mat>             xforms;
+    // per instance offset into this frame's palette slice
+    vector<uint>            bones;
     vector<LightWrapper>    lights;
     Window* io;
+    mat vp;
     int use_flat_normals = 0;
     int roughness = 255;
+    int culling = 1;
+    int instancing = 1;
+    int lod = 1;
+    float lodBias = 1;
+    uint nlods[MAX_LODS] = {};
+    uint nvisible = 0;
+    uint nculled = 0;
 
     inline static vector<Scene*> scenes;
     static Scene* Create(Window& win)
@@ -39,9 +151,33 @@ struct Scene
         scene->active_camera = new Camera(&win);
         scene->cameras.push_back(scene->active_camera);
         scene->cbuffer = Buffer::Create(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, 1024 * 64);
-        scene->lights.resize(32);
-        for (auto& light : scene->lights)
+        scene->objects = Buffer::Create(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, NFRAMES * MAX_OBJECTS * sizeof(ObjectData));
+        scene->instances = Buffer::Create(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, NFRAMES * MAX_OBJECTS * sizeof(InstanceData));
+        scene->palettes = Buffer::Create(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, NFRAMES * MAX_PALETTE_BONES * sizeof(mat));
+        scene->draws = Buffer::Create(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, MAX_OBJECTS * sizeof(GpuDraw));
+        //two regions per frame, one per occlusion phase
+        scene->commands = Buffer::Create(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+            NFRAMES * 2 * MAX_OBJECTS * sizeof(VkDrawIndexedIndirectCommand), LOCAL_MEMORY);
+        scene->counts = Buffer::Create(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            NFRAMES * 2 * MAX_DRAW_GROUPS * sizeof(uint), LOCAL_MEMORY);
+        scene->visibility = Buffer::Create(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            MAX_OBJECTS * sizeof(uint), LOCAL_MEMORY);
+        for (uint i = 0; i < NFRAMES; ++i)
         {
+            scene->lightData[i] = Buffer::Create(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, MAX_LIGHTS * sizeof(PointLight));
+            scene->clusters[i] = Buffer::Create(VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, sizeof(ClusterData));
+        }
+        scene->SetLightCount(32);
+        return scene;
+    }
+
+    void SetLightCount(uint count)
+    {
+        uint first = lights.size();
+        lights.resize(std::min(count, (uint)MAX_LIGHTS));
+        for (uint i = first; i < lights.size(); ++i)
+        {
+            auto& light = lights[i];
             light.t = float(rand() % 255) / 255;
             light.speed = 0.01 + 0.5 * float(rand() % 255) / 255;
             light.radius = 8 * (float(rand() % 255) / 255.f + 0.01);
@@ -50,19 +186,19 @@ struct Scene
             light.color.z = float(rand() % 255) / 255;
             light.color.w = 1;
         }
-        return scene;
     }
 
     void UpdateBuffer()
     {
         UpdateLights();
-        cbuffer->Get<mat>()[0]  = active_camera->update();
+        vp = active_camera->update();
+        cbuffer->Get<mat>()[0]  = vp;
         cbuffer->Get<vec4>()[4] = active_camera->pos;
-        cbuffer->Get<int>()[20] = lights.size();
+        cbuffer->Get<int>()[20] = std::min((uint)lights.size(), (uint)UBO_LIGHTS);
         cbuffer->Get<int>()[21] = use_flat_normals;
         cbuffer->Get<int>()[22] = roughness;
         Light* light = (Light*)(cbuffer->Get<vec4>() + 6);
-        for (int i = 0; i < lights.size(); ++i)
+        for (int i = 0; i < lights.size() && i < UBO_LIGHTS; ++i)
             light[i] = lights[i];
     }
 
@@ -76,25 +212,70 @@ struct Scene
         }
     }
 
+    // turns bounding radius over view depth into the size SelectLod takes
+    float LodScale()
+    {
+        return active_camera->prj.y.y * lodBias / LOD_SWITCH;
+    }
+
+    // permutation key of shader1: bit 0 flat normals
+    uint64 Variant()
+    {
+        return uint64(use_flat_normals & 1);
+    }
+
+    void Cull();
+    void BuildLightGrid(uint frame, uint width, uint height);
+    void BuildDraws();
+    void UploadPalettes(uint frame);
+    void UploadInstances(uint frame);
     void DrawHierarchy();
 };
 
+// one pool per recording task and frame in flight, a task owns its pool so recording needs no locks
+struct RecordContext
+{
+    VkCommandPool   pool;
+    StateCache      state;
+};
+
 struct Renderer
 {
     Window          win;
     Swapchain       sc;
     VkRenderPass    pass;
+    VkRenderPass    resumePass;
     uint            ms;
     uint            current;
+    VkPipelineBindPoint bindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
     Image*          depthBuffer;
     Image*          colorBuffer;
     PipelineManager pipes;
+    PipelineStatistics stats;
+    ComputeHandle   cull;
+    ComputeHandle   downsample;
+    DepthPyramid    hiz;
 
     VkCommandPool   pool;
     VkClearValue    clear[3];
     FrameResource   resource[NFRAMES];
     CommandBuffer   cmd[NFRAMES];
+    StateCache      state[NFRAMES];
     VkFence         fence[NFRAMES];
+    RecordContext   record[NFRAMES][MAX_RECORD_THREADS];
+    StateCache      ui[NFRAMES];
+    // the depth pre-pass of parallel recording, executed on its own so it gets its own statistics region
+    RecordContext   depthPass[NFRAMES];
+    uint            nrecord;
+    int             parallel = 1;
+    VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE;
+    int             filterState = 1;
+    int             prepass = 0;
+    // whether each frame was recorded with the depth pre-pass, and the last shader1 fragment invocations seen without and with it
+    int             prepassed[NFRAMES] = {};
+    uint64          shaded[2] = {};
+    uint            issued = 0;
+    uint            elided = 0;
 
     typedef void (*PFN_callback)(void* ptr, struct Renderer* r);
 
@@ -107,54 +288,70 @@ struct Renderer
     vector<Callback> callbacks;
 
     Scene* current_scene;
+    double record_ms = 0;
+    // running average of record_ms with pooled sets and with a push descriptor set
+    double record_avg[2] = {};
+    // push descriptor slot picked in the ui, applied at the next frame boundary
+    int pushSet = PUSH_DESCRIPTOR_SET;
 
     Renderer(uint x, uint y, bool fs, uint ms, vector<PipelineCreateInfo> createInfos);
+    ~Renderer();
     void Init();
     void Recreate();
     void AcquireNextImage();
     void AddCallback(PFN_callback cb, void* ptr);
     void BeginCommands();
-    void BeginFrame();
+    void BeginFrame(bool pass = true);
+    void BeginRenderPass(bool resume = false);
     void EndFrame();
-    void BindPipeline(const char* pipeline);
+    void BindPipeline(PipelineHandle pipeline, uint64 variant = 0);
+    void BindCompute(ComputeHandle pipeline);
+    void Dispatch(uint x, uint y, uint z);
+    void DispatchIndirect(Buffer* buffer, uint64 offset);
+    void ComputeBarrier();
     void SetViewport(float x, float y, float w, float h);
-    void BindVertexBuffer(Buffer* buffer);
+    void SetScissor(int x, int y, uint w, uint h);
+    void BindVertexBuffer(Buffer* buffer, uint64 offset = 0, uint stream = 0);
     void BindIndexBuffer(Buffer* buffer, uint64 offset);
     void Draw(uint nvertex, uint ninstance, uint first_vertex, uint first_inst);
     void DrawIndexed(uint nidx, uint ninstance, uint first_idx, uint voffset, uint first_instance);
+    void DrawIndexedIndirectCount(Buffer* buffer, uint64 offset, Buffer* count, uint64 countOffset, uint maxDraws);
     void InitImgui();
     void DrawImguiWindows();
+    void BeginSecondary(StateCache& state);
+    void PrepareScene();
+    void RenderScene();
+    void RenderGpuDriven();
+    void CullPhase(uint phase);
+    void BuildPyramid();
+    // two phase occlusion culling on the gpu driven path, needs a multisampled depth buffer for hiz.comp
+    bool Occlusion() { return current_scene->gpuDriven && cull && downsample && ms > 1 && current_scene->occlusion; }
+    void BuildQueue();
+    void RecordBatches(StateCache& state, uint begin, uint end, bool depthOnly = false);
+    void RecordParallel();
 
     template<class...T> 
     void BindSet(uint slot, Bindable* head, T*... tail)
     {
-        auto set = pipes.FindSet(slot, head, tail...);
-        cmd[current].BindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, pipes.layout, slot, 1, &set, 0, 0);
+        BindSet(state[current], slot, head, tail...);
     }
 
-    template<class T>
-    void PushConstants(T&& constant)
+    template<class...T>
+    void BindSet(StateCache& state, uint slot, Bindable* head, T*... tail)
     {
-        cmd[current].PushConstants(pipes.layout, VkShaderStageFlags(17), 0, sizeof(T), (void*)&constant);
+        if ((int)slot == pipes.pushSet)
+        {
+            pipes.PushSet(state.cmd, bindPoint, slot, head, tail...);
+            return state.SetPushed(bindPoint, slot);
+        }
+        state.BindDescriptorSet(bindPoint, pipes.layout, slot, pipes.FindSet(slot, head, tail...));
     }
 
-    void RenderScene()
+    template<class T>
+    void PushConstants(T&& constant)
     {
-        auto scene = current_scene;
-        scene->UpdateBuffer();
-        BindPipeline("shader1");
-        BindSet(0, scene->cbuffer);
-        for (auto& m : scene->mesh)
-        {
-            PushConstants(m.xform.Get());
-            BindVertexBuffer(m.mesh->buffer);
-            BindIndexBuffer(m.mesh->buffer, m.mesh->ioffset);
-            for (auto& sm : m.submesh)
-            {
-                BindSet(2, sm.mat.textures[0], sm.mat.textures[1], sm.mat.textures[2]);
-                DrawIndexed(sm.nidx, 1, sm.ioffset, sm.voffset, 0);
-            }
-        }     
+        state[current].PushConstants(pipes.layout, pipes.pushStages, 0, sizeof(T), (void*)&constant);
     }
+
 };
 
@@ -0,0 +1,246 @@
+#include "Shader.h"
+#include "shaderc/shaderc.hpp"
+#include "spirv_cross/spirv_glsl.hpp"
+#include "mango/core/hash.hpp"
+#include "filesystem"
+#include "unordered_set"
+
+#define SHADER_CACHE_MAGIC 0x56505348
+#define SHADER_CACHE_VERSION 1
+
+using namespace SPIRV_CROSS_NAMESPACE;
+
+struct ShaderCacheHeader
+{
+	uint	magic;
+	uint	version;
+	uint64	hash;
+	uint	stage;
+	uint	nspirv;
+	uint	nbindings;
+	uint	ninputs;
+};
+
+static string ReadSource(string const& path)
+{
+	std::ifstream file(path);
+	return string((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+//appends every file pulled in through #include "..." so edits to headers change the hash too
+static void GatherIncludes(string const& source, string& key, std::unordered_set<string>& seen)
+{
+	size_t pos = 0;
+	while ((pos = source.find("#include", pos)) != string::npos)
+	{
+		size_t begin = source.find('"', pos);
+		size_t end = begin == string::npos ? begin : source.find('"', begin + 1);
+		if (end == string::npos || source.find('\n', pos) < end)
+		{
+			pos += 8;
+			continue;
+		}
+		string name = source.substr(begin + 1, end - begin - 1);
+		pos = end;
+		if (!seen.insert(name).second)
+			continue;
+		string include = ReadSource(SHADER_DIR + name);
+		key += include;
+		GatherIncludes(include, key, seen);
+	}
+}
+
+struct ShaderIncluder : shaderc::CompileOptions::IncluderInterface
+{
+	struct Include
+	{
+		shaderc_include_result	result;
+		string					name;
+		string					source;
+	};
+
+	shaderc_include_result* GetInclude(const char* requested, shaderc_include_type type, const char* requesting, size_t depth) override
+	{
+		auto include = new Include{};
+		include->name = requested;
+		include->source = ReadSource(SHADER_DIR + include->name);
+		include->result.source_name = include->name.data();
+		include->result.source_name_length = include->name.size();
+		include->result.content = include->source.data();
+		include->result.content_length = include->source.size();
+		include->result.user_data = include;
+		return &include->result;
+	}
+
+	void ReleaseInclude(shaderc_include_result* result) override
+	{
+		delete (Include*)result->user_data;
+	}
+};
+
+Shader Shader::Load(const char* path, VkShaderStageFlagBits stage, vector<string> const& defines)
+{
+	Shader shader = {};
+	shader.stage = stage;
+
+	string source = ReadSource(SHADER_DIR + string(path));
+	string key = source;
+	std::unordered_set<string> seen;
+	GatherIncludes(source, key, seen);
+	for (auto& define : defines)
+		key += "\n#define " + define;
+	key += "\nstage " + std::to_string(stage) + " optimization performance";
+	shader.hash = mango::xxhash64(SHADER_CACHE_VERSION, mango::ConstMemory((const mango::u8*)key.data(), key.size()));
+
+	char name[32];
+	sprintf(name, "%016llx.spv", shader.hash);
+	string cached = SHADER_CACHE_DIR;
+	cached += name;
+	if (shader.Read(cached.data()))
+		return shader;
+
+	if (shader.Compile(source, path, defines))
+	{
+		shader.Reflect();
+		shader.Write(cached.data());
+	}
+	return shader;
+}
+
+bool Shader::Compile(string const& source, const char* path, vector<string> const& defines)
+{
+	string spath = SHADER_DIR;
+	spath += path;
+	shaderc::Compiler compiler;
+	shaderc::CompileOptions options;
+	options.SetOptimizationLevel(shaderc_optimization_level_performance);
+	options.SetIncluder(std::make_unique<ShaderIncluder>());
+	for (auto& define : defines)
+	{
+		auto eq = define.find('=');
+		if (eq == string::npos)
+			options.AddMacroDefinition(define);
+		else
+			options.AddMacroDefinition(define.substr(0, eq), define.substr(eq + 1));
+	}
+
+	shaderc_shader_kind kind;
+	switch (stage)
+	{
+	case VK_SHADER_STAGE_VERTEX_BIT: kind = shaderc_vertex_shader; break;
+	case VK_SHADER_STAGE_COMPUTE_BIT: kind = shaderc_compute_shader; break;
+	default: kind = shaderc_fragment_shader; break;
+	}
+	auto compiling = compiler.CompileGlslToSpv(source, kind, spath.data(), options);
+	auto msg = compiling.GetErrorMessage();
+	if (msg.size()) printf("[SPIRV ERROR]\n%s\n", msg.data());
+	spirv.assign(compiling.cbegin(), compiling.cend());
+	return !spirv.empty();
+}
+
+void Shader::Reflect()
+{
+	auto type_stride = [](SPIRType::BaseType type)
+	{
+		switch (type)
+		{
+		case SPIRType::Int: case SPIRType::UInt: case SPIRType::Float: return 4;
+		case SPIRType::Int64: case SPIRType::UInt64: case SPIRType::Double:return 8;
+		default:return 0;
+		}
+	};
+
+	auto type_format = [](SPIRType::BaseType type, uint vecsize)
+	{
+		uint format = 98;
+		switch (vecsize)
+		{
+		case 4:	format += 3;
+		case 3:	format += 3;
+		case 2: format += 3;
+		}
+		switch (type)
+		{
+		case SPIRType::Float: format++;
+		case SPIRType::Int: format++;
+		}
+		return VkFormat(format);
+	};
+
+	CompilerGLSL comp(spirv);
+	ShaderResources res = comp.get_shader_resources();
+
+	vector<std::pair<VkDescriptorType, SmallVector<Resource>*>> uniforms = {
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, &res.uniform_buffers },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, &res.storage_buffers },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, &res.storage_images },
+		{ VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, &res.subpass_inputs },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, &res.sampled_images },
+	};
+	for (auto& pair : uniforms)
+		for (auto& in : *pair.second)
+			bindings.push_back({
+				comp.get_decoration(in.id, spv::DecorationDescriptorSet),
+				comp.get_decoration(in.id, spv::DecorationBinding),
+				pair.first });
+
+	if (stage != VK_SHADER_STAGE_VERTEX_BIT)
+		return;
+
+	for (auto& in : res.stage_inputs)
+	{
+		SPIRType type = comp.get_type(in.type_id);
+		inputs.push_back({
+			comp.get_decoration(in.id, spv::DecorationLocation),
+			type_format(type.basetype, type.vecsize),
+			uint(type_stride(type.basetype) * type.vecsize) });
+	}
+	std::sort(inputs.begin(), inputs.end(), [](auto& a, auto& b) { return a.location < b.location; });
+}
+
+bool Shader::Read(const char* path)
+{
+	std::ifstream file(path, std::ios::binary);
+	ShaderCacheHeader header = {};
+	if (!file.read((char*)&header, sizeof(header)))
+		return false;
+	if (header.magic != SHADER_CACHE_MAGIC || header.version != SHADER_CACHE_VERSION || header.hash != hash || header.stage != stage)
+		return false;
+
+	spirv.resize(header.nspirv);
+	bindings.resize(header.nbindings);
+	inputs.resize(header.ninputs);
+	file.read((char*)spirv.data(), spirv.size() * sizeof(uint));
+	file.read((char*)bindings.data(), bindings.size() * sizeof(ShaderBinding));
+	file.read((char*)inputs.data(), inputs.size() * sizeof(ShaderInput));
+	if (file && !spirv.empty())
+		return true;
+
+	spirv.clear();
+	bindings.clear();
+	inputs.clear();
+	return false;
+}
+
+void Shader::Write(const char* path)
+{
+	ShaderCacheHeader header = { SHADER_CACHE_MAGIC, SHADER_CACHE_VERSION, hash, (uint)stage,
+		(uint)spirv.size(), (uint)bindings.size(), (uint)inputs.size() };
+
+	std::error_code err;
+	std::filesystem::create_directories(SHADER_CACHE_DIR, err);
+
+	//same write-then-rename as the pipeline cache, so a crash mid-write never leaves a torn entry
+	string tmp = path;
+	tmp += ".tmp";
+	{
+		std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+		file.write((char*)&header, sizeof(header));
+		file.write((char*)spirv.data(), spirv.size() * sizeof(uint));
+		file.write((char*)bindings.data(), bindings.size() * sizeof(ShaderBinding));
+		file.write((char*)inputs.data(), inputs.size() * sizeof(ShaderInput));
+		if (!file)
+			return;
+	}
+	std::filesystem::rename(tmp, path, err);
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "pch.h"
+#include "vector"
+
+using std::vector;
+
+#define SHADER_DIR "shaders\\"
+#define SHADER_CACHE_DIR "shaders\\cache\\"
+
+struct ShaderBinding
+{
+	uint				set;
+	uint				binding;
+	VkDescriptorType	type;
+};
+
+struct ShaderInput
+{
+	uint		location;
+	VkFormat	format;
+	uint		size;
+};
+
+//compiled spirv plus everything the pipeline manager needs from reflection,
+//cached on disk under the hash of the source, its includes, defines and compile options
+struct Shader
+{
+	VkShaderStageFlagBits	stage;
+	uint64					hash;
+	vector<uint>			spirv;
+	vector<ShaderBinding>	bindings;
+	vector<ShaderInput>		inputs;
+
+	static Shader Load(const char* path, VkShaderStageFlagBits stage, vector<string> const& defines = {});
+
+private:
+	bool Compile(string const& source, const char* path, vector<string> const& defines);
+	void Reflect();
+	bool Read(const char* path);
+	void Write(const char* path);
+};
@@ -0,0 +1,172 @@
+#include "Simplify.h"
+#include "algorithm"
+#include "cfloat"
+#include "functional"
+#include "unordered_map"
+
+void Simplifier::Quadric::operator += (Quadric const& q)
+{
+	a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+	b2 += q.b2; bc += q.bc; bd += q.bd;
+	c2 += q.c2; cd += q.cd;
+	d2 += q.d2;
+}
+
+double Simplifier::Quadric::Error(vec3 p) const
+{
+	double x = p.x, y = p.y, z = p.z;
+	double e = a2 * x * x + b2 * y * y + c2 * z * z + d2
+		+ 2 * (ab * x * y + ac * x * z + bc * y * z + ad * x + bd * y + cd * z);
+	//rounding can take a perfect fit slightly below zero
+	return std::max(e, 0.0);
+}
+
+static vec3 Normal(vec3 a, vec3 b, vec3 c)
+{
+	return cross(b - a, c - a);
+}
+
+//the cheaper direction of the edge, locked vertices only receive
+bool Simplifier::Cost(uint a, uint b, Collapse& c)
+{
+	if (locked[a] && locked[b])
+		return false;
+	Quadric q = quadrics[a];
+	q += quadrics[b];
+	double ab = locked[a] ? DBL_MAX : q.Error(positions[b]);
+	double ba = locked[b] ? DBL_MAX : q.Error(positions[a]);
+	c = ab <= ba ? Collapse{ ab, a, b, { stamps[a], stamps[b] } } : Collapse{ ba, b, a, { stamps[b], stamps[a] } };
+	return true;
+}
+
+//a triangle around from whose normal turns over once from sits on to would fold the surface
+bool Simplifier::Flips(uint from, uint to)
+{
+	for (uint t : adjacent[from])
+	{
+		auto& f = tris[t];
+		if (dead[t] || f.x == to || f.y == to || f.z == to)
+			continue;
+		vec3 p[3] = { positions[f.x], positions[f.y], positions[f.z] };
+		vec3 before = Normal(p[0], p[1], p[2]);
+		p[f.x == from ? 0 : f.y == from ? 1 : 2] = positions[to];
+		if (before.dot(Normal(p[0], p[1], p[2])) <= 0)
+			return true;
+	}
+	return false;
+}
+
+void Simplifier::Push(Collapse const& c)
+{
+	heap.push_back(c);
+	std::push_heap(heap.begin(), heap.end(), std::greater<Collapse>());
+}
+
+void Simplifier::Run(vec3u const* idx, uint ntri, vec3 const* pos, uint nvertex, uint target, double maxError, vector<vec3u>& out)
+{
+	positions = pos;
+	tris.assign(idx, idx + ntri);
+	dead.assign(ntri, false);
+	adjacent.assign(nvertex, {});
+	quadrics.assign(nvertex, {});
+	remap.resize(nvertex);
+	stamps.assign(nvertex, 0);
+	locked.assign(nvertex, false);
+	heap.clear();
+	for (uint i = 0; i < nvertex; ++i)
+		remap[i] = i;
+
+	//unweighted planes, so the error stays a squared distance whatever the triangle sizes
+	uint live = 0;
+	std::unordered_map<uint64, uint> edges;
+	for (uint t = 0; t < ntri; ++t)
+	{
+		auto& f = tris[t];
+		if (f.x == f.y || f.y == f.z || f.z == f.x)
+		{
+			dead[t] = true;
+			continue;
+		}
+		live++;
+		vec3 n = Normal(pos[f.x], pos[f.y], pos[f.z]);
+		float area = n.len();
+		if (area > 0)
+		{
+			n = n * (1.f / area);
+			double a = n.x, b = n.y, c = n.z, d = -n.dot(pos[f.x]);
+			Quadric plane = { a * a, a * b, a * c, a * d, b * b, b * c, b * d, c * c, c * d, d * d };
+			for (uint v : { f.x, f.y, f.z })
+				quadrics[v] += plane;
+		}
+		uint v[3] = { f.x, f.y, f.z };
+		for (uint e = 0; e < 3; ++e)
+		{
+			adjacent[v[e]].push_back(t);
+			uint a = std::min(v[e], v[(e + 1) % 3]), b = std::max(v[e], v[(e + 1) % 3]);
+			edges[uint64(a) << 32 | b]++;
+		}
+	}
+
+	//open and non manifold edges
+	for (auto& [key, count] : edges)
+		if (count != 2)
+			locked[key >> 32] = locked[key & 0xffffffff] = true;
+
+	Collapse c;
+	for (auto& [key, count] : edges)
+		if (Cost(key >> 32, key & 0xffffffff, c))
+			Push(c);
+
+	while (live > target && !heap.empty())
+	{
+		std::pop_heap(heap.begin(), heap.end(), std::greater<Collapse>());
+		c = heap.back();
+		heap.pop_back();
+		if (c.cost > maxError)
+			break;
+		uint from = c.from, to = c.to;
+		//an end merged away already, its edges were requeued from the survivor
+		if (remap[from] != from || remap[to] != to)
+			continue;
+		//a neighbouring collapse changed a quadric since this cost was taken
+		if (stamps[from] != c.stamps[0] || stamps[to] != c.stamps[1])
+		{
+			if (Cost(from, to, c))
+				Push(c);
+			continue;
+		}
+		if (Flips(from, to))
+			continue;
+
+		remap[from] = to;
+		quadrics[to] += quadrics[from];
+		stamps[to]++;
+		for (uint t : adjacent[from])
+		{
+			if (dead[t])
+				continue;
+			auto& f = tris[t];
+			if (f.x == to || f.y == to || f.z == to)
+			{
+				dead[t] = true;
+				live--;
+				continue;
+			}
+			(f.x == from ? f.x : f.y == from ? f.y : f.z) = to;
+			adjacent[to].push_back(t);
+		}
+		adjacent[from].clear();
+
+		auto& around = adjacent[to];
+		around.erase(std::remove_if(around.begin(), around.end(), [this](uint t) { return dead[t]; }), around.end());
+		for (uint t : around)
+			for (uint v : { tris[t].x, tris[t].y, tris[t].z })
+				if (v != to && Cost(to, v, c))
+					Push(c);
+	}
+
+	out.clear();
+	for (uint t = 0; t < ntri; ++t)
+		if (!dead[t])
+			out.push_back(tris[t]);
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "pch.h"
+#include "vmath.h"
+#include "vector"
+
+using std::vector;
+
+//quadric error edge collapse, a vertex only ever merges into one of its neighbours so the simplified triangles
+//index the original vertex buffer and every attribute stays valid,
+//open edges, which include uv and normal seams since those split vertices, keep their vertices in place
+struct Simplifier
+{
+	//symmetric 4x4 matrix of summed plane equations, a point's error is its summed squared distance to the planes
+	struct Quadric
+	{
+		double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+
+		void operator += (Quadric const& q);
+		double Error(vec3 p) const;
+	};
+
+	//moves from onto to, stamps are the generations of both ends when the cost was computed
+	struct Collapse
+	{
+		double	cost;
+		uint	from, to;
+		uint	stamps[2];
+
+		bool operator > (Collapse const& c) const { return cost > c.cost; }
+	};
+
+	vec3 const*				positions;
+	vector<vec3u>			tris;
+	vector<bool>			dead;
+	vector<vector<uint>>	adjacent;
+	vector<Quadric>			quadrics;
+	vector<uint>			remap;
+	vector<uint>			stamps;
+	vector<bool>			locked;
+	vector<Collapse>		heap;
+
+	//collapses cheapest first until at most target triangles are left or the next collapse would move a surface
+	//further than sqrt(maxError), out receives the surviving triangles
+	void Run(vec3u const* idx, uint ntri, vec3 const* pos, uint nvertex, uint target, double maxError, vector<vec3u>& out);
+
+	bool Cost(uint a, uint b, Collapse& c);
+	bool Flips(uint from, uint to);
+	void Push(Collapse const& c);
+};
@@ -8,8 +8,17 @@
 struct App : Renderer
 {
 	App() :
-		Renderer(800, 600, 1, 8, { { .shader = "shader1", .depth = 1, .cull = 1 },
-			{ .shader = "anim",  .depth = 1, .cull = 1 }})
+		Renderer(800, 600, 1, 8, { { .shader = "shader1", .depth = DEPTH_WRITE, .cull = 1, .permutation = { 1 },
+			.vertex = {
+				{ 0, VK_FORMAT_R32G32B32_SFLOAT },
+				{ 1, VK_FORMAT_A2B10G10R10_UNORM_PACK32 },
+				{ 1, VK_FORMAT_A2B10G10R10_UNORM_PACK32 },
+				{ 1, VK_FORMAT_A2B10G10R10_UNORM_PACK32 },
+				{ 1, VK_FORMAT_R16G16_SFLOAT } } },
+			{ .shader = "depth", .depth = DEPTH_ONLY, .cull = 1 },
+			{ .shader = "anim",  .depth = DEPTH_WRITE, .cull = 1 },
+			{ .shader = "cull", .compute = 1 },
+			{ .shader = "hiz", .compute = 1 }})
 	{
 		InitImgui();
 	}
@@ -25,7 +34,9 @@ struct App : Renderer
 		current_scene->roughness = 144;
 		while (PollWindows())
 		{
-			BeginFrame();
+			BeginFrame(false);
+			PrepareScene();
+			BeginRenderPass();
 			RenderScene();
 			EndFrame();
 		}
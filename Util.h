@@ -15,7 +15,7 @@ inline VkAttachmentDescription MkAttachment(VkFormat format, uint ms, VkAttachme
 
 inline VkAttachmentDescription MkDepthAttachment(uint ms)
 {
-    return MkAttachment(VK_FORMAT_D32_SFLOAT, ms, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_DONT_CARE, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
+    return MkAttachment(VK_FORMAT_D32_SFLOAT, ms, VK_ATTACHMENT_LOAD_OP_CLEAR, VK_ATTACHMENT_STORE_OP_STORE, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL);
 }
 
 inline VkAttachmentDescription MkColorAttachment(uint ms, uint present, VkAttachmentLoadOp load_op)
@@ -96,30 +96,47 @@ inline VkImageView MkImageView(VkImage img, VkFormat format, VkImageAspectFlags
 	return CreateImageView(&info);
 }
 
-inline VkRenderPass MkRenderPass(uint ms)
+//resume continues a frame that compute work split in two, every attachment is loaded in the layout the first pass left it in
+inline VkRenderPass MkRenderPass(uint ms, bool resume = false)
 {
-	if (ms == 1)
-	{
-		VkAttachmentDescription attachments[2] = {
-			MkColorAttachment(1, 1, VK_ATTACHMENT_LOAD_OP_CLEAR),
-			MkDepthAttachment(1),
-		};
-		VkAttachmentReference ref[2] = { MkColorRef(0), MkDepthRef(1) };
-		VkSubpassDescription subpass = MkSubpassDesc(1);
-		subpass.pColorAttachments = &ref[0];
-		subpass.pDepthStencilAttachment = &ref[1];
-		return MkRenderPass(sizeof(attachments) / sizeof(VkAttachmentDescription), attachments, 1, &subpass, 0, 0);
-	}
-
-	VkAttachmentDescription attachments[3] = {
-	MkColorAttachment(ms, 0, VK_ATTACHMENT_LOAD_OP_CLEAR),
-	MkDepthAttachment(ms),
-	MkColorAttachment(1, 1, VK_ATTACHMENT_LOAD_OP_LOAD)
+	//the depth buffer is read by compute between passes and frames as the source of the depth pyramid,
+	//a resumed pass loads the color, resolve and depth attachments the split off pass wrote
+	VkSubpassDependency deps[2] = {
+		{ VK_SUBPASS_EXTERNAL, 0,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT },
+		{ 0, VK_SUBPASS_EXTERNAL,
+			VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+			VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+			VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT },
 	};
+
+	VkAttachmentDescription attachments[3];
 	VkAttachmentReference ref[3] = { MkColorRef(0), MkDepthRef(1), MkColorRef(2) };
 	VkSubpassDescription subpass = MkSubpassDesc(1);
 	subpass.pColorAttachments = &ref[0];
 	subpass.pDepthStencilAttachment = &ref[1];
-	subpass.pResolveAttachments = &ref[2];
-	return MkRenderPass(sizeof(attachments) / sizeof(VkAttachmentDescription), attachments, 1, &subpass, 0, 0);
+	uint count = 2;
+	if (ms == 1)
+	{
+		attachments[0] = MkColorAttachment(1, 1, VK_ATTACHMENT_LOAD_OP_CLEAR);
+		attachments[1] = MkDepthAttachment(1);
+	}
+	else
+	{
+		attachments[0] = MkColorAttachment(ms, 0, VK_ATTACHMENT_LOAD_OP_CLEAR);
+		attachments[1] = MkDepthAttachment(ms);
+		attachments[2] = MkColorAttachment(1, 1, VK_ATTACHMENT_LOAD_OP_LOAD);
+		subpass.pResolveAttachments = &ref[2];
+		count = 3;
+	}
+	for (uint i = 0; resume && i < count; ++i)
+	{
+		attachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		attachments[i].initialLayout = attachments[i].finalLayout;
+	}
+	return MkRenderPass(count, attachments, 1, &subpass, 2, deps);
 }
\ No newline at end of file
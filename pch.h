@@ -12,6 +12,9 @@
 #ifndef NFRAMES
 #define NFRAMES 3
 #endif // !NFRAMES
+#ifndef PUSH_DESCRIPTOR_SET
+#define PUSH_DESCRIPTOR_SET -1
+#endif // !PUSH_DESCRIPTOR_SET
 
 typedef unsigned uint;
 typedef unsigned long long uint64;
@@ -0,0 +1,6 @@
+#version 450
+
+// depth only, color writes are masked off by the pipeline
+void main() 
+{
+}
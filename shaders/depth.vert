@@ -0,0 +1,29 @@
+#version 450
+
+// position only pass of the depth pre-pass, reads just stream 0
+layout(location = 0) in vec3 pos;
+// must match shader1.vert bit for bit, the shading pass tests EQUAL against this depth
+invariant gl_Position;
+
+layout(set=0, binding=0) uniform UBO00 {
+    mat4 prj;
+} cam;
+
+struct Object {
+    mat4 xf;
+    mat4 prev;
+    uint material;
+    uint bones;
+    uint pad[6];
+};
+
+layout(set=0, binding=1) readonly buffer SBO01 {
+    Object o[];
+} objects;
+
+void main() 
+{
+    Object xf = objects.o[gl_InstanceIndex];
+    vec4 fragpos = xf.xf * vec4(pos, 1);
+    gl_Position = cam.prj * fragpos;
+}
@@ -17,8 +17,34 @@ layout(set=0, binding=0) uniform UBO00 {
 	vec4 pos;
     ivec4 nLights;
     vec4 lights[1024];
+    vec4 forward;
+    // tiles per pixel in xy, log depth to slice scale and bias in zw
+    vec4 cluster;
 } cam;
 
+// same values as LightGrid.h
+const uint CLUSTER_X = 16;
+const uint CLUSTER_Y = 9;
+const uint CLUSTER_Z = 24;
+const uint CLUSTER_COUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+
+struct Light {
+    vec4 pos;   // w is the range
+    vec4 color;
+};
+
+layout(std430, set=0, binding=2) readonly buffer Lights {
+    Light l[];
+} lights;
+
+layout(std430, set=0, binding=3) readonly buffer Clusters {
+    uvec2 cells[CLUSTER_COUNT];
+    uint indices[];
+} clusters;
+
+// driven by the pipeline variant key, see Scene::Variant
+layout(constant_id = 0) const int FLAT_NORMALS = 0;
+
 const float PI = 3.14159265359;
 float DistributionGGX(vec3 N, vec3 H, float roughness);
 float GeometrySchlickGGX(float NdotV, float roughness);
@@ -35,23 +61,33 @@ void main()
 	vec3 metal = texture(metalic, tex).rgb;
     vec3 N = texture(normal, tex).rgb * 2 - 1;
     N = normalize(norm * N);
-    if(cam.nLights.y == 1)
+    if(FLAT_NORMALS == 1)
         N = normalize(norm * vec3(0, 0, 1));
     vec3 V = normalize((cam.pos - pos).xyz);
 
     vec3 F0 = vec3(0.04); 
     F0 = mix(F0, col, metal);
 	           
+    // only the lights binned into this fragment's froxel
+    float depth = dot(pos.xyz - cam.pos.xyz, cam.forward.xyz);
+    uint slice = uint(clamp(log(depth) * cam.cluster.z + cam.cluster.w, 0.0, float(CLUSTER_Z - 1)));
+    uvec2 tile = min(uvec2(gl_FragCoord.xy * cam.cluster.xy), uvec2(CLUSTER_X - 1, CLUSTER_Y - 1));
+    uvec2 cell = clusters.cells[(slice * CLUSTER_Y + tile.y) * CLUSTER_X + tile.x];
+
     // reflectance equation
     vec3 Lo = vec3(0.0);
-    for(int i = 0; i < cam.nLights.x; ++i) 
+    for(uint i = 0; i < cell.y; ++i) 
     {
-        // calculate per-light radiance
-        vec3 L = normalize((cam.lights[2*i] - pos).xyz);
+        Light light = lights.l[clusters.indices[cell.x + i]];
+
+        // calculate per-light radiance, inverse square windowed to zero at the range
+        vec3 toLight      = light.pos.xyz - pos.xyz;
+        float distance    = length(toLight);
+        vec3 L = toLight / max(distance, 0.0001);
         vec3 H = normalize(V + L);
-        float distance    = length(L);
-        float attenuation = 1.0 / (distance * distance);
-        vec3 radiance     = cam.lights[2*i + 1].xyz * attenuation;        
+        float window      = clamp(1.0 - pow(distance / light.pos.w, 4.0), 0.0, 1.0);
+        float attenuation = window * window / max(distance * distance, 0.01);
+        vec3 radiance     = light.color.xyz * attenuation;        
         
         // cook-torrance brdf
         float roughness = float(cam.nLights.z) / 255.0;
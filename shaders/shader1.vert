@@ -1,26 +1,41 @@
 #version 450
 
+// stream 0: positions, stream 1: A2B10G10R10_UNORM normal/tangent/bitangent and R16G16_SFLOAT uv
 layout(location = 0) in vec3 pos;
-layout(location = 1) in vec3 norm;
-layout(location = 2) in vec3 tangent;
-layout(location = 3) in vec3 bitangent;
+layout(location = 1) in vec3 packed_norm;
+layout(location = 2) in vec3 packed_tangent;
+layout(location = 3) in vec3 packed_bitangent;
 layout(location = 4) in vec2 tex;
 layout(location = 0) out vec2 outtex;
 layout(location = 1) out mat3 outnorm;
 layout(location = 4) out vec4 fragpos;
 layout(location = 5) out vec3 fnorm;
+// must match depth.vert bit for bit, the shading pass after a depth pre-pass tests EQUAL
+invariant gl_Position;
 
 
 layout(set=0, binding=0) uniform UBO00 {
     mat4 prj;
 } cam;
 
-layout(push_constant) uniform push_block {
+struct Object {
     mat4 xf;
-} xf;
+    mat4 prev;
+    uint material;
+    uint bones;
+    uint pad[6];
+};
+
+layout(set=0, binding=1) readonly buffer SBO01 {
+    Object o[];
+} objects;
 
 void main() 
 {
+    Object xf = objects.o[gl_InstanceIndex];
+    vec3 norm = packed_norm * 2 - 1;
+    vec3 tangent = packed_tangent * 2 - 1;
+    vec3 bitangent = packed_bitangent * 2 - 1;
     fragpos = xf.xf * vec4(pos, 1);
     gl_Position = cam.prj * fragpos;
     outtex = tex;